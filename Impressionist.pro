@@ -3,8 +3,11 @@ TEMPLATE = subdirs
 # Sub-project names
 SUBDIRS = \
     sub_glew \
-    sub_impr
+    sub_impr \
+    sub_batch
 
 sub_glew.subdir = Libraries/glew-2.0.0
 sub_impr.subdir = Impressionist
 sub_impr.depends = sub_glew
+sub_batch.subdir = ImpressionistBatch
+sub_batch.depends = sub_glew
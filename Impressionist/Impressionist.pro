@@ -26,6 +26,15 @@ HEADERS += \
     src/paintview.h \
     src/glinclude.h \
     src/layer.h \
+    src/streamingtexture.h \
+    src/strokebatch.h \
+    src/softwarerasterizer.h \
+    src/tilecache.h \
+    src/tiledimage.h \
+    src/imageloader.h \
+    src/referenceimage.h \
+    src/autopainter.h \
+    src/gradientfield.h \
     src/vectors.h \
     src/forms/filterkerneldialog.h \
     src/forms/bilateralgaussdialog.h \
@@ -34,10 +43,14 @@ HEADERS += \
     src/qlabeledslider.h \
     src/exceptions.h \
     src/circularbuffer.h \
+    src/threadpool.h \
+    src/previewrenderer.h \
+    src/alignedallocator.h \
     src/brushes/brush.h \
     src/brushes/linesegmentbrush.h \
     src/brushes/pointbrush.h \
     src/filters/filter.h \
+    src/filters/filtersimd.h \
     src/rgbabuffer.h \
     src/brushes/circlebrush.h \
     src/brushes/scattercirclebrush.h \
@@ -45,7 +58,8 @@ HEADERS += \
     src/brushes/linebrush.h \
     src/brushes/scatterpointbrush.h \
     src/brushes/uwbrush.h \
-    src/brushes/star.h
+    src/brushes/star.h \
+    src/brushes/strokespacer.h
 
 # List of source code files to be used when building the project
 SOURCES += \
@@ -53,7 +67,18 @@ SOURCES += \
     src/mainwindow.cpp \
     src/paintview.cpp \
     src/layer.cpp \
+    src/streamingtexture.cpp \
+    src/strokebatch.cpp \
+    src/softwarerasterizer.cpp \
+    src/tilecache.cpp \
+    src/tiledimage.cpp \
+    src/imageloader.cpp \
+    src/referenceimage.cpp \
+    src/autopainter.cpp \
+    src/gradientfield.cpp \
     src/glerror.cpp \
+    src/threadpool.cpp \
+    src/previewrenderer.cpp \
     src/forms/filterkerneldialog.cpp \
     src/forms/bilateralgaussdialog.cpp \
     src/forms/brushdialog.cpp \
@@ -62,6 +87,7 @@ SOURCES += \
     src/brushes/linesegmentbrush.cpp \
     src/brushes/pointbrush.cpp \
     src/filters/filter.cpp \
+    src/filters/filtersimd.cpp \
     src/forms/bilateralmeandialog.cpp \
     src/brushes/linebrush.cpp \
     src/brushes/circlebrush.cpp \
@@ -69,7 +95,8 @@ SOURCES += \
     src/brushes/scatterlinebrush.cpp \
     src/brushes/scatterpointbrush.cpp \
     src/brushes/uwbrush.cpp \
-    src/brushes/star.cpp
+    src/brushes/star.cpp \
+    src/brushes/strokespacer.cpp
 
 # List of UI files to be processed by user interface coimpiler
 FORMS += \
@@ -0,0 +1,43 @@
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Allocator for std::vector whose storage starts on an Alignment byte boundary,
+// e.g. so vector loads of the first elements never straddle a cache line.
+template<typename T, std::size_t Alignment = 32>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t count) {
+        // Over-allocate, then store the start of the raw block just before the aligned pointer
+        void* raw = std::malloc(count * sizeof(T) + Alignment + sizeof(void*));
+        if (raw == nullptr) throw std::bad_alloc();
+        std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + Alignment - 1) & ~(std::uintptr_t)(Alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* pointer, std::size_t) {
+        if (pointer != nullptr) std::free(reinterpret_cast<void**>(pointer)[-1]);
+    }
+};
+
+template<typename T, typename U, std::size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+template<typename T, typename U, std::size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+#endif // ALIGNEDALLOCATOR_H
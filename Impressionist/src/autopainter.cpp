@@ -0,0 +1,109 @@
+#include "autopainter.h"
+#include <threadpool.h>
+#include <filters/filter.h>
+#include <algorithm>
+#include <cmath>
+
+void AutoPainter::Paint(const std::shared_ptr<const ReferenceImage>& reference, Brush& brush, const Settings& settings,
+                        const DrawFunction& draw, const SnapshotFunction& snapshot) {
+    if (!reference || settings.layers == 0) return;
+
+    unsigned int width = reference->GetWidth();
+    unsigned int height = reference->GetHeight();
+    unsigned int finest_size = brush.GetSize();
+    unsigned int angle = brush.GetAngle();
+    std::mt19937 random(settings.seed);
+    GradientField gradient;
+    unsigned int previous_size = 0;
+
+    brush.SetColorMode(ColorMode::Sample);
+    for (unsigned int layer = 0; layer < settings.layers; layer++) {
+        // The brush clamps sizes it can't paint, which may leave layers the same size
+        brush.SetSize(finest_size << std::min(settings.layers - 1 - layer, 16u));
+        unsigned int size = brush.GetSize();
+        if (size == previous_size) continue;
+
+        // Each layer samples a reference of its own, which the brush holds on to while its dabs are drawn
+        std::shared_ptr<const ReferenceImage> blurred = reference;
+        float sigma = settings.blur_factor * size;
+        if (sigma > 0.0f) {
+            std::shared_ptr<RGBABuffer> pixels = std::make_shared<RGBABuffer>(width, height);
+            Filter::ApplyGaussianBlur(reference->GetPixels(), pixels->Bytes, width, height, sigma, sigma >= 5.0f ? BlurMode::Box : BlurMode::Exact);
+            blurred = std::make_shared<const ReferenceImage>(pixels);
+        }
+        brush.SetColorImage(blurred);
+        gradient.Compute(blurred->GetPixels(), width, height);
+
+        // The first layer paints everywhere, whatever the canvas holds
+        std::shared_ptr<const RGBABuffer> canvas;
+        if (previous_size != 0) canvas = snapshot();
+        if (canvas && (canvas->Width != width || canvas->Height != height)) canvas.reset();
+        previous_size = size;
+
+        std::vector<Dab> dabs = PlaceDabs(blurred->GetPixels(), gradient, canvas.get(), width, height, std::max(1u, size / 2), settings.threshold, random);
+        // Drop the snapshot before drawing, so the canvas doesn't have to copy its pixels to keep it intact
+        canvas.reset();
+        draw(brush, dabs);
+    }
+
+    brush.SetSize(finest_size);
+    brush.SetAngle(angle);
+    brush.SetColorImage(reference);
+}
+
+std::vector<AutoPainter::Dab> AutoPainter::PlaceDabs(const unsigned char* reference, const GradientField& gradient, const RGBABuffer* canvas,
+                                                     unsigned int width, unsigned int height, unsigned int grid, float threshold, std::mt19937& random) {
+    unsigned int columns = (width + grid - 1) / grid;
+    unsigned int rows = (height + grid - 1) / grid;
+    // Each row of cells is placed on its own, then they are joined in order so the result never depends on the threads
+    std::vector<std::vector<Dab>> row_dabs(rows);
+    std::vector<unsigned int> seeds(rows);
+    for (unsigned int& seed : seeds) seed = random();
+
+    ThreadPool::Instance().ParallelFor(rows, 1, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int row = band_begin; row < band_end; row++) {
+            std::mt19937 row_random(seeds[row]);
+            std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
+            unsigned int top = row * grid;
+            unsigned int bottom = std::min(top + grid, height);
+            for (unsigned int column = 0; column < columns; column++) {
+                unsigned int left = column * grid;
+                unsigned int right = std::min(left + grid, width);
+
+                glm::vec2 pos;
+                if (canvas == nullptr) {
+                    pos = glm::vec2(left + jitter(row_random) * (right - left), top + jitter(row_random) * (bottom - top));
+                } else {
+                    float total = 0.0f;
+                    float largest = -1.0f;
+                    for (unsigned int y = top; y < bottom; y++) {
+                        // Snapshots come bottom row first
+                        const unsigned char* canvas_row = canvas->Bytes + 4 * (height - 1 - y) * width;
+                        const unsigned char* reference_row = reference + 4 * y * width;
+                        for (unsigned int x = left; x < right; x++) {
+                            float distance = 0.0f;
+                            for (unsigned int p = 0; p < 3; p++) {
+                                float difference = float(canvas_row[4 * x + p]) - float(reference_row[4 * x + p]);
+                                distance += difference * difference;
+                            }
+                            distance = std::sqrt(distance);
+                            total += distance;
+                            if (distance > largest) {
+                                largest = distance;
+                                pos = glm::vec2(x + 0.5f, y + 0.5f);
+                            }
+                        }
+                    }
+                    if (total <= threshold * (right - left) * (bottom - top)) continue;
+                }
+                row_dabs[row].push_back({ pos, gradient.GetAngle(pos) });
+            }
+        }
+    });
+
+    std::vector<Dab> dabs;
+    for (std::vector<Dab>& placed : row_dabs) dabs.insert(dabs.end(), placed.begin(), placed.end());
+    // Painted in grid order, later dabs would always cover the same side of earlier ones
+    std::shuffle(dabs.begin(), dabs.end(), random);
+    return dabs;
+}
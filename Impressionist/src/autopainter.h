@@ -0,0 +1,53 @@
+#ifndef AUTOPAINTER_H
+#define AUTOPAINTER_H
+
+#include <rgbabuffer.h>
+#include <referenceimage.h>
+#include <vectors.h>
+#include <gradientfield.h>
+#include <brushes/brush.h>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+// Places brush dabs over a whole canvas, for painting without a mouse
+class AutoPainter {
+public:
+    // A dab placed by the painter, with the angle the brush is turned to for it
+    struct Dab {
+        glm::vec2 pos;
+        unsigned int angle;
+    };
+
+    struct Settings {
+        // Brush sizes painted, each twice the next, ending with the brush's own size
+        unsigned int layers = 3;
+        // Sigma of each layer's blur of the reference, relative to its brush size
+        float blur_factor = 0.5f;
+        // Mean color distance from a layer's reference, out of 255, below which a cell is left as it is
+        float threshold = 20.0f;
+        // The same seed paints the same picture
+        unsigned int seed = 0;
+    };
+
+    // Draws dabs with brush, which samples its colors from its color image
+    typedef std::function<void(Brush& brush, const std::vector<Dab>& dabs)> DrawFunction;
+    // Current canvas, in the row order of PaintView::GetSnapshot
+    typedef std::function<std::shared_ptr<const RGBABuffer>()> SnapshotFunction;
+
+    // Paints the reference with brush in layers from coarse to fine, after Hertzmann's painterly rendering with one dab per stroke.
+    // Each layer blurs the reference in proportion to its brush size, and dabs it on a grid of half that size with the brush turned
+    // across the gradient. The first layer covers the canvas; the others only cells still too far from their layer's reference,
+    // at the pixel farthest off, which takes a snapshot per layer. The brush's size, angle and color image are restored afterwards.
+    static void Paint(const std::shared_ptr<const ReferenceImage>& reference, Brush& brush, const Settings& settings,
+                      const DrawFunction& draw, const SnapshotFunction& snapshot);
+
+private:
+    // Dabs of a layer on a grid of cells of side grid, turned across gradient. With no canvas every cell gets one,
+    // otherwise only those whose mean color distance from reference is above threshold.
+    static std::vector<Dab> PlaceDabs(const unsigned char* reference, const GradientField& gradient, const RGBABuffer* canvas,
+                                      unsigned int width, unsigned int height, unsigned int grid, float threshold, std::mt19937& random);
+};
+
+#endif // AUTOPAINTER_H
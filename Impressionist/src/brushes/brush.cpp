@@ -4,6 +4,17 @@
 #include <QFormLayout>
 #include <QComboBox>
 #include <qlabeledslider.h>
+#include <QLabel>
+#include <algorithm>
+#include <cmath>
+#include <brushes/pointbrush.h>
+#include <brushes/uwbrush.h>
+#include <brushes/linebrush.h>
+#include <brushes/scatterlinebrush.h>
+#include <brushes/scatterpointbrush.h>
+#include <brushes/circlebrush.h>
+#include <brushes/scattercirclebrush.h>
+#include <brushes/star.h>
 
 Brush::Brush(const std::string& name) :
     widget_(new QWidget),
@@ -11,13 +22,11 @@ Brush::Brush(const std::string& name) :
     name_(name),
     size_slider_(new QLabeledSlider),
     color_(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)),
-    color_image_(nullptr),
-    color_image_width_(0),
-    color_image_height_(0),
     color_mode_(ColorMode::Solid),
-    color_location_(-1),
+    batch_(nullptr),
     opacity_slider_(new QLabeledSlider),
-    angle_slider_(new QLabeledSlider)
+    angle_slider_(new QLabeledSlider),
+    spacing_slider_(new QLabeledSlider)
 {
     widget_->setLayout(layout_);
 
@@ -35,10 +44,29 @@ Brush::Brush(const std::string& name) :
     layout_->addRow("Angle", angle_slider_);
     angle_slider_->SetValue(0);
 
+    // Spacing Slider, in percent of the size
+    spacing_slider_->SetRange(1, 200);
+    layout_->addRow("Spacing", spacing_slider_);
+    spacing_slider_->SetValue(25);
+
     // Default Values
     SetSize(12);
 }
 
+std::unique_ptr<Brush> Brush::Create(Brushes type) {
+    switch (type) {
+        case Brushes::Point: return std::make_unique<PointBrush>("Points");
+        case Brushes::Line: return std::make_unique<LineBrush>("Lines");
+        case Brushes::Circle: return std::make_unique<CircleBrush>("Circles");
+        case Brushes::ScatterPoint: return std::make_unique<ScatterPointBrush>("Scattered Points");
+        case Brushes::ScatterLine: return std::make_unique<ScatterLineBrush>("Scattered Lines");
+        case Brushes::ScatterCircle: return std::make_unique<ScatterCircleBrush>("Scattered Circles");
+        case Brushes::UW: return std::make_unique<UWBrush>("UW");
+        case Brushes::Star: return std::make_unique<StarBrush>("Star");
+    }
+    return nullptr;
+}
+
 QWidget* Brush::GetWidget() const {
     return widget_;
 }
@@ -60,23 +88,30 @@ void Brush::SetColor(const glm::vec3& color) {
     color_ = color;
 }
 
-void Brush::SetColorImage(const unsigned char* color_image, unsigned int width, unsigned int height) {
+void Brush::SetColorImage(std::shared_ptr<const ReferenceImage> color_image) {
     color_image_ = color_image;
-    color_image_width_ = width;
-    color_image_height_ = height;
 }
 
 void Brush::SetColorMode(ColorMode color_mode) {
     color_mode_ = color_mode;
 }
 
-void Brush::SetColorLocation(GLint color_location) {
-    color_location_ = color_location;
+void Brush::SetBatch(StrokeBatch& batch) {
+    batch_ = &batch;
 }
 
 void Brush::UseColor(const glm::vec4& color) {
-    assert(color_location_ != -1);
-    glUniform4fv(color_location_, 1, glm::value_ptr(color));
+    assert(batch_ != nullptr);
+    batch_->SetColor(color);
+}
+
+float Brush::GetReach(const glm::vec2 pos) const {
+    // Covers every brush whose dab fits in a square of side size around pos
+    return GetSize();
+}
+
+float Brush::GetFootprint() const {
+    return GetSize();
 }
 
 unsigned int Brush::GetSize() const {
@@ -92,29 +127,62 @@ unsigned int Brush::GetAngle() const {
     return angle_slider_->GetValue();
 }
 
+bool Brush::SetParameter(const std::string& name, int value) {
+    // Sliders are found by their label, so every brush's own sliders work without a setter each
+    for (int row = 0; row < layout_->rowCount(); row++) {
+        QLayoutItem* label = layout_->itemAt(row, QFormLayout::LabelRole);
+        QLayoutItem* field = layout_->itemAt(row, QFormLayout::FieldRole);
+        if (label == nullptr || field == nullptr) continue;
+        QLabel* label_widget = qobject_cast<QLabel*>(label->widget());
+        QLabeledSlider* slider = dynamic_cast<QLabeledSlider*>(field->widget());
+        if (label_widget != nullptr && slider != nullptr && label_widget->text().toStdString() == name) {
+            slider->SetValue(value);
+            return true;
+        }
+    }
+    return false;
+}
+
+float Brush::GetSpacing() const {
+    // At least a pixel, closer dabs would only paint over each other
+    return std::max(1.0f, 0.01f * spacing_slider_->GetValue() * GetSize());
+}
+
 
 glm::vec4 Brush::GetColor(glm::ivec2 position) const {
     if (color_mode_ == ColorMode::Sample && color_image_ != nullptr) {
-        unsigned int width = color_image_width_;
-        unsigned int height = color_image_height_;
-
-        // Don't exceed the coordinates of the color image
-        if (position.x < 0) position.x = 0;
-        else if (position.x >= width) position.x = width - 1;
-        if (position.y < 0) position.y = 0;
-        else if (position.y >= height) position.y = height - 1;
-
-        // Sample the color image at the position
-        glm::vec4 color;
-        int index = (position.y * 4) * width + (position.x * 4);
-        color.r = color_image_[index++] / 255.0f;
-        color.g = color_image_[index++] / 255.0f;
-        color.b = color_image_[index++] / 255.0f;
-        color.a = color_image_[index++] / 255.0f;
-
+        // The level whose pixels are as wide as the dab averages the area it covers, blended with the next one up
+        // as the size grows, so a dab costs the same whatever its size and its color doesn't jump between levels
+        float lod = std::log2(std::max(1.0f, GetFootprint()));
+        lod = std::min(lod, float(color_image_->GetLevelCount() - 1));
+        unsigned int level = (unsigned int)lod;
+        float blend = lod - level;
+
+        glm::vec2 center = glm::vec2(position) + 0.5f;
+        glm::vec4 color = SampleLevel(level, center);
+        if (blend > 0.0f) color = glm::mix(color, SampleLevel(level + 1, center), blend);
         return color;
     } else {
         return glm::vec4(color_, 1.0f);
     }
 }
 
+glm::vec4 Brush::SampleLevel(unsigned int level, glm::vec2 pos) const {
+    const RGBABuffer& image = color_image_->GetLevel(level);
+    // Level pixels have their centers at half units too, positions outside the image use the nearest pixel
+    glm::vec2 texel = pos / float(1u << level) - 0.5f;
+    glm::vec2 base = glm::floor(texel);
+    glm::vec2 weight = texel - base;
+    int x0 = glm::clamp(int(base.x), 0, int(image.Width) - 1);
+    int x1 = glm::clamp(int(base.x) + 1, 0, int(image.Width) - 1);
+    int y0 = glm::clamp(int(base.y), 0, int(image.Height) - 1);
+    int y1 = glm::clamp(int(base.y) + 1, 0, int(image.Height) - 1);
+
+    auto fetch = [&image](int x, int y) {
+        const unsigned char* pixel = image.Bytes + 4 * (size_t(y) * image.Width + x);
+        return glm::vec4(pixel[0], pixel[1], pixel[2], pixel[3]);
+    };
+    glm::vec4 top = glm::mix(fetch(x0, y0), fetch(x1, y0), weight.x);
+    glm::vec4 bottom = glm::mix(fetch(x0, y1), fetch(x1, y1), weight.x);
+    return glm::mix(top, bottom, weight.y) / 255.0f;
+}
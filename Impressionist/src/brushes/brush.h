@@ -2,8 +2,11 @@
 #define BRUSH_H
 
 #include <glinclude.h>
+#include <memory>
 #include <string>
 #include <vectors.h>
+#include <strokebatch.h>
+#include <referenceimage.h>
 
 class QWidget;
 class QFormLayout;
@@ -38,6 +41,10 @@ enum class ColorMode {
 class Brush {
 public:
     Brush(const std::string& name);
+    virtual ~Brush() { }
+
+    // Creates a brush of the given type, named as the brush dialog lists it
+    static std::unique_ptr<Brush> Create(Brushes type);
 
     QWidget* GetWidget() const;
     std::string GetName() const;
@@ -45,13 +52,22 @@ public:
     virtual void SetAngle(unsigned int angle);
     virtual void SetSize(unsigned int size);
     virtual void SetColor(const glm::vec3& color);
-    virtual void SetColorImage(const unsigned char* color_image, unsigned int width, unsigned int height);
+    // Image the Sample color mode reads from, kept by the brush until replaced. nullptr samples nothing.
+    virtual void SetColorImage(std::shared_ptr<const ReferenceImage> color_image);
     virtual void SetColorMode(ColorMode color_mode);
 
     unsigned int GetAngle() const;
+    unsigned int GetSize() const;
+
+    // Sets the slider labeled name, like "Opacity" or "Density". Returns false if the brush has none.
+    bool SetParameter(const std::string& name, int value);
+
+    // Distance between dabs along a stroke, in pixels
+    float GetSpacing() const;
 
-    // Must be called before drawing
-    virtual void SetColorLocation(GLint color_location);
+    // Must be called before drawing, the brush adds its dabs to batch
+    void SetBatch(StrokeBatch& batch);
+    // The solid color, or in the Sample mode the color image averaged over GetFootprint around position
     glm::vec4 GetColor(glm::ivec2 position = glm::ivec2(0, 0)) const;
 
     // Called for drawing
@@ -59,6 +75,12 @@ public:
     virtual void BrushMove(const glm::vec2 pos) = 0;
     virtual void BrushEnd(const glm::vec2 pos) = 0;
 
+    // Farthest from pos the last BrushBegin/BrushMove/BrushEnd call at pos may have drawn, so the canvas knows what changed
+    virtual float GetReach(const glm::vec2 pos) const;
+
+    // Width in pixels of the area a dab covers, which the Sample color mode averages the color image over
+    virtual float GetFootprint() const;
+
 protected:
     QWidget* widget_;
     QFormLayout* layout_;
@@ -66,21 +88,22 @@ protected:
     QLabeledSlider* size_slider_;
     QLabeledSlider* opacity_slider_;
     QLabeledSlider* angle_slider_;
+    QLabeledSlider* spacing_slider_;
     ColorMode color_mode_;
-    GLint color_location_;
+    StrokeBatch* batch_;
     glm::vec3 color_;
 
     // Image to sample colors from
-    const unsigned char* color_image_;
-    unsigned int color_image_width_;
-    unsigned int color_image_height_;
+    std::shared_ptr<const ReferenceImage> color_image_;
 
     // Called inside the BrushBegin/BrushMove/BrushEnd methods
-    unsigned int GetSize() const;
     unsigned int GetOpacity() const;
 
 
     void UseColor(const glm::vec4& color);
+
+    // Bilinear sample of a mip level of the color image, pos counting level 0 pixels with their centers at half units
+    glm::vec4 SampleLevel(unsigned int level, glm::vec2 pos) const;
 };
 
 #endif // BRUSH_H
@@ -1,5 +1,4 @@
 #include "circlebrush.h"
-#include <paintview.h>
 #include <math.h>
 
 CircleBrush::CircleBrush(const std::string& name) :
@@ -14,7 +13,6 @@ void CircleBrush::BrushBegin(const glm::vec2 pos) {
 void CircleBrush::BrushMove(const glm::vec2 pos) {
 
     float size = GetSize() * 1.0;
-    int numTriangles = 90;
     float radius = size / 2.0;
     float opacityRatio = 0.01 * GetOpacity();
 
@@ -23,20 +21,8 @@ void CircleBrush::BrushMove(const glm::vec2 pos) {
     color.a = opacityRatio;
     UseColor(color);
 
-    std::vector<GLfloat> vertex = {pos.x, pos.y};
-    for(int i = 0; i <= numTriangles; i++) {
-        float endPosX = pos.x + (radius * cos(i * 2 * M_PI / numTriangles));
-        float endPosY = pos.y + (radius * sin(i * 2 * M_PI / numTriangles));
-        // Vertex of circle
-        vertex.push_back(endPosX);
-        vertex.push_back(endPosY);
-    }
-
-    // Upload the vertex data to GPU buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex.size(), vertex.data(), GL_STREAM_DRAW);
     // draw triangles to represent the circle
-    glDrawArrays(GL_TRIANGLE_FAN, 0, numTriangles + 2);
-
+    batch_->AddStamp(Stamp::Circle, pos, glm::mat2(radius));
 }
 
 void CircleBrush::BrushEnd(const glm::vec2 pos) {
@@ -1,9 +1,9 @@
 #include "linebrush.h"
-#include <paintview.h>
 #include <qlabeledslider.h>
 #include <QFormLayout>
 #include <iostream>
 #include <math.h>
+#include <algorithm>
 
 LineBrush::LineBrush(const std::string& name) :
     Brush(name),
@@ -19,6 +19,16 @@ LineBrush::LineBrush(const std::string& name) :
 }
 
 // Added functionality
+float LineBrush::GetReach(const glm::vec2 pos) const {
+    // Half the diagonal of the rotated size x thickness rectangle
+    return 0.5f * std::sqrt(float(GetSize() * GetSize() + GetThickness() * GetThickness()));
+}
+
+float LineBrush::GetFootprint() const {
+    // Colors averaged wider than the line would blur the edges it follows
+    return float(std::min(GetSize(), GetThickness()));
+}
+
 unsigned int LineBrush::GetThickness() const {
     return thickness_slider_->GetValue();
 }
@@ -39,31 +49,12 @@ void LineBrush::BrushMove(const glm::vec2 pos) {
     color.a = opacityRatio; 
     UseColor(color);  
 
-    float x1 = pos.x - (size * 0.5f) * cos(angle/180 * M_PI) + (0.5f * thickness) * sin(angle/180 * M_PI);
-    float y1 = pos.y + (size * 0.5f) * sin(angle/180 * M_PI) + (0.5f * thickness) * cos(angle/180 * M_PI);
-    float x2 = pos.x - (size * 0.5f) * cos(angle/180 * M_PI) - (0.5f * thickness) * sin(angle/180 * M_PI);
-    float y2 = pos.y + (size * 0.5f) * sin(angle/180 * M_PI) - (0.5f * thickness) * cos(angle/180 * M_PI);
-    float x3 = pos.x + (size * 0.5f) * cos(angle/180 * M_PI) - (0.5f * thickness) * sin(angle/180 * M_PI);
-    float y3 = pos.y - (size * 0.5f) * sin(angle/180 * M_PI) - (0.5f * thickness) * cos(angle/180 * M_PI);
-    float x4 = pos.x + (size * 0.5f) * cos(angle/180 * M_PI) + (0.5f * thickness) * sin(angle/180 * M_PI);
-    float y4 = pos.y - (size * 0.5f) * sin(angle/180 * M_PI) + (0.5f * thickness) * cos(angle/180 * M_PI);
-
-    // Points to draw
-    std::vector<GLfloat> vertex = {};
-    vertex.push_back(x1);
-    vertex.push_back(y1);
-    vertex.push_back(x2);
-    vertex.push_back(y2);
-    vertex.push_back(x4);
-    vertex.push_back(y4);
-    vertex.push_back(x3);
-    vertex.push_back(y3);
-
-    // Upload the vertex data to GPU buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex.size(), vertex.data(), GL_STREAM_DRAW);
+    // The unit square stretched to size along the angle and to thickness across it
+    glm::vec2 along = size * glm::vec2(cos(angle/180 * M_PI), -sin(angle/180 * M_PI));
+    glm::vec2 across = thickness * glm::vec2(sin(angle/180 * M_PI), cos(angle/180 * M_PI));
 
     // Draw triangles to represent the line
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    batch_->AddStamp(Stamp::Square, pos, glm::mat2(along, across));
 }
 
 void LineBrush::BrushEnd(const glm::vec2 pos) {
@@ -19,11 +19,13 @@ void LineSegmentBrush::BrushMove(const glm::vec2 pos) {
         pos.x, pos.y
     };
 
-    // Upload the vertex data to GPU buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertices.size(), vertices.data(), GL_STREAM_DRAW);
-
     // Draw the line segment
-    glDrawArrays(GL_LINES, 0, 2);
+    batch_->AddLines(vertices);
+}
+
+float LineSegmentBrush::GetReach(const glm::vec2 pos) const {
+    // The segment runs back to where the stroke started
+    return glm::length(pos - start_position_) + 1.0f;
 }
 
 void LineSegmentBrush::BrushEnd(const glm::vec2 pos) {
@@ -11,6 +11,7 @@ public:
     virtual void BrushBegin(const glm::vec2 pos) override;
     virtual void BrushMove(const glm::vec2 pos) override;
     virtual void BrushEnd(const glm::vec2 pos) override;
+    virtual float GetReach(const glm::vec2 pos) const override;
 
 private:
     glm::vec2 start_position_;
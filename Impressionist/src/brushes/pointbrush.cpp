@@ -1,5 +1,4 @@
 #include "pointbrush.h"
-#include <paintview.h>
 #include <iostream>
 PointBrush::PointBrush(const std::string& name) :
     Brush(name)
@@ -19,17 +18,8 @@ void PointBrush::BrushMove(const glm::vec2 pos) {
     color.a = opacityRatio;
     UseColor(color);
 
-    // Points to draw
-    std::vector<GLfloat> vertex = {
-        pos.x, pos.y
-    };
-
-    // Upload the vertex data to GPU buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex.size(), vertex.data(), GL_STREAM_DRAW);
-
-    // Set the size of the points and draw them
-    glPointSize(GetSize());
-    glDrawArrays(GL_POINTS, 0, 1);
+    // Draw the point with the size of the brush
+    batch_->AddStamp(Stamp::Square, pos, glm::mat2(float(GetSize())));
 }
 
 void PointBrush::BrushEnd(const glm::vec2 pos) {
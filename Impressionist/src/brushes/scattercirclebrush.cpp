@@ -1,5 +1,4 @@
 #include "scattercirclebrush.h"
-#include <paintview.h>
 #include <random>
 #include <qlabeledslider.h>
 #include <QFormLayout>
@@ -24,6 +23,11 @@ ScatterCircleBrush::ScatterCircleBrush(const std::string& name) :
 
 
 // Added functionality
+float ScatterCircleBrush::GetReach(const glm::vec2 pos) const {
+    // Circles of diameter size, scattered up to a quarter of the radius along each axis
+    return 0.5f * GetSize() + 0.5f * GetRadius();
+}
+
 unsigned int ScatterCircleBrush::GetRadius() const {
     return radius_slider_->GetValue();
 }
@@ -42,7 +46,6 @@ void ScatterCircleBrush::BrushMove(const glm::vec2 pos) {
     int numCircles = GetDensity();
     float offsetRange = GetRadius() * 0.5;
     float size = GetSize() * 1.0;
-    int numTriangles = 90;
     float radius = size / 2.0;
     float opacityRatio = 0.01 * GetOpacity();
 
@@ -57,19 +60,8 @@ void ScatterCircleBrush::BrushMove(const glm::vec2 pos) {
         color.a = opacityRatio;
         UseColor(color);
 
-        std::vector<GLfloat> vertex = {currPos.x, currPos.y};
-        for(int i = 0; i <= numTriangles; i++) {
-            float endPosX = currPos.x + (radius * cos(i * 2 * M_PI / numTriangles));
-            float endPosY = currPos.y + (radius * sin(i * 2 * M_PI / numTriangles));
-            // Vertex of circle
-            vertex.push_back(endPosX);
-            vertex.push_back(endPosY);
-        }
-
-        // Upload the vertex data to GPU buffer
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex.size(), vertex.data(), GL_STREAM_DRAW);
         // draw triangles to represent the circle
-        glDrawArrays(GL_TRIANGLE_FAN, 0, numTriangles + 2);
+        batch_->AddStamp(Stamp::Circle, currPos, glm::mat2(radius));
     }
 }
 
@@ -10,6 +10,7 @@ public:
     virtual void BrushBegin(const glm::vec2 pos) override;
     virtual void BrushMove(const glm::vec2 pos) override;
     virtual void BrushEnd(const glm::vec2 pos) override;
+    virtual float GetReach(const glm::vec2 pos) const override;
 
 private:
     QLabeledSlider* radius_slider_;
@@ -1,8 +1,8 @@
 #include "scatterlinebrush.h"
-#include <paintview.h>
 #include <qlabeledslider.h>
 #include <QFormLayout>
 #include <math.h>
+#include <algorithm>
 
 ScatterLineBrush::ScatterLineBrush(const std::string& name) :
     Brush(name),
@@ -31,6 +31,16 @@ ScatterLineBrush::ScatterLineBrush(const std::string& name) :
 }
 
 // Added functionality
+float ScatterLineBrush::GetReach(const glm::vec2 pos) const {
+    // A line brush dab, scattered up to a quarter of the radius along each axis
+    return 0.5f * std::sqrt(float(GetSize() * GetSize() + GetThickness() * GetThickness())) + 0.5f * GetRadius();
+}
+
+float ScatterLineBrush::GetFootprint() const {
+    // Colors averaged wider than the line would blur the edges it follows
+    return float(std::min(GetSize(), GetThickness()));
+}
+
 unsigned int ScatterLineBrush::GetThickness() const {
     return thickness_slider_->GetValue();
 }
@@ -56,6 +66,9 @@ void ScatterLineBrush::BrushMove(const glm::vec2 pos) {
     float thickness = GetThickness() * 1.0;
     float opacityRatio = 0.01 * GetOpacity();
     float angle = 360.0 - GetAngle() * 1.0;
+    // The unit square stretched to size along the angle and to thickness across it
+    glm::vec2 along = size * glm::vec2(cos(angle/180 * M_PI), -sin(angle/180 * M_PI));
+    glm::vec2 across = thickness * glm::vec2(sin(angle/180 * M_PI), cos(angle/180 * M_PI));
 
     for(int i = 0; i < numLines; i++) {
         // Range (-0.5 - 0.5) * offsetRange
@@ -68,31 +81,8 @@ void ScatterLineBrush::BrushMove(const glm::vec2 pos) {
         color.a = opacityRatio;
         UseColor(color);
 
-        float x1 = currPos.x - (size * 0.5f) * cos(angle/180 * M_PI) + (0.5f * thickness) * sin(angle/180 * M_PI);
-        float y1 = currPos.y + (size * 0.5f) * sin(angle/180 * M_PI) + (0.5f * thickness) * cos(angle/180 * M_PI);
-        float x2 = currPos.x - (size * 0.5f) * cos(angle/180 * M_PI) - (0.5f * thickness) * sin(angle/180 * M_PI);
-        float y2 = currPos.y + (size * 0.5f) * sin(angle/180 * M_PI) - (0.5f * thickness) * cos(angle/180 * M_PI);
-        float x3 = currPos.x + (size * 0.5f) * cos(angle/180 * M_PI) - (0.5f * thickness) * sin(angle/180 * M_PI);
-        float y3 = currPos.y - (size * 0.5f) * sin(angle/180 * M_PI) - (0.5f * thickness) * cos(angle/180 * M_PI);
-        float x4 = currPos.x + (size * 0.5f) * cos(angle/180 * M_PI) + (0.5f * thickness) * sin(angle/180 * M_PI);
-        float y4 = currPos.y - (size * 0.5f) * sin(angle/180 * M_PI) + (0.5f * thickness) * cos(angle/180 * M_PI);
-
-        // Points to draw
-        std::vector<GLfloat> vertex = {};
-        vertex.push_back(x1);
-        vertex.push_back(y1);
-        vertex.push_back(x2);
-        vertex.push_back(y2);
-        vertex.push_back(x4);
-        vertex.push_back(y4);
-        vertex.push_back(x3);
-        vertex.push_back(y3);
-
-        // Upload the vertex data to GPU buffer
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex.size(), vertex.data(), GL_STREAM_DRAW);
-
         // Draw triangles to represent the lines
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        batch_->AddStamp(Stamp::Square, currPos, glm::mat2(along, across));
     }
 }
 
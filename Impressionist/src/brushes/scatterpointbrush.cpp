@@ -1,5 +1,4 @@
 #include "scatterpointbrush.h"
-#include <paintview.h>
 #include <random>
 #include <qlabeledslider.h>
 #include <QFormLayout>
@@ -25,6 +24,11 @@ ScatterPointBrush::ScatterPointBrush(const std::string& name) :
 
 
     // Added functionality
+    float ScatterPointBrush::GetReach(const glm::vec2 pos) const {
+        // Points of side size, scattered up to a quarter of the radius along each axis
+        return GetSize() + 0.5f * GetRadius();
+    }
+
     unsigned int ScatterPointBrush::GetRadius() const {
         return radius_slider_->GetValue();
     }
@@ -56,17 +60,8 @@ void ScatterPointBrush::BrushMove(const glm::vec2 pos) {
         color.a = opacityRatio;
         UseColor(color);
 
-        // Point to draw
-        std::vector<GLfloat> vertex = {
-            pos.x + offsetX, pos.y + offsetY,
-        };
-
-        // Upload the vertex data to GPU buffer
-        glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vertex.size(), vertex.data(), GL_STREAM_DRAW);
-
-        // Set the size of the points and draw them
-        glPointSize(size);
-        glDrawArrays(GL_POINTS, 0, 1);
+        // Draw the point with the size of the brush
+        batch_->AddStamp(Stamp::Square, currPos, glm::mat2(size));
     }
 }
 
@@ -0,0 +1,27 @@
+#include "strokespacer.h"
+
+StrokeSpacer::StrokeSpacer() :
+    last_position_(0.0f, 0.0f),
+    travelled_(0.0f)
+{
+}
+
+void StrokeSpacer::Begin(const glm::vec2 pos) {
+    last_position_ = pos;
+    travelled_ = 0.0f;
+}
+
+void StrokeSpacer::Move(const glm::vec2 pos, float spacing, std::vector<glm::vec2>& dabs) {
+    glm::vec2 delta = pos - last_position_;
+    float length = glm::length(delta);
+    if (length < MIN_MOVE) return;
+
+    // Distance along this move to the next dab
+    float next = spacing - travelled_;
+    while (next <= length) {
+        dabs.push_back(last_position_ + delta * (next / length));
+        next += spacing;
+    }
+    travelled_ = length - (next - spacing);
+    last_position_ = pos;
+}
@@ -0,0 +1,29 @@
+#ifndef STROKESPACER_H
+#define STROKESPACER_H
+
+#include <vectors.h>
+#include <vector>
+
+// Resamples the path of a stroke, known only at mouse events, into dabs a fixed distance apart.
+// Fast strokes get dabs in the gaps between events, slow ones skip events until the cursor moved far enough.
+class StrokeSpacer {
+public:
+    StrokeSpacer();
+
+    // Starts a new stroke at pos, where the first dab goes
+    void Begin(const glm::vec2 pos);
+
+    // Continues the stroke in a straight line to pos, appending the dabs along it to dabs
+    void Move(const glm::vec2 pos, float spacing, std::vector<glm::vec2>& dabs);
+
+private:
+    // Moves shorter than this are jitter, they are merged with the following ones
+    static constexpr float MIN_MOVE = 0.5f;
+
+    // Where the stroke got to so far
+    glm::vec2 last_position_;
+    // Distance along the stroke since the last dab
+    float travelled_;
+};
+
+#endif // STROKESPACER_H
@@ -1,124 +1,758 @@
 #include "filter.h"
+#include "filtersimd.h"
+#include <threadpool.h>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 void Filter::ApplyFilterKernel(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, Kernel &k, int offset, bool clamping) {
     // REQUIREMENT: Implement this function
-    for (unsigned int i = 0; i < height; i++) {
-        for (unsigned int j = 0; j < width; j++) {
-            // Use calculated value for r,g,b channel
-            for (unsigned int p = 0; p < 3; p++) {
-                float filteredValue = 0.0;
-                for (int l = -2; l <= 2; l++) {
-                    for (int h = -2; h <= 2; h++) {
-                        filteredValue += GetValue(source, i + l, j + h, width, height, p) * k.matrix[2-l][h+2];
+    if (k.Height() % 2 == 0 || k.Width() % 2 == 0) {
+        throw std::invalid_argument("Filter kernels must have an odd width and height");
+    }
+    int vertical_radius = k.Height() / 2;
+    int horizontal_radius = k.Width() / 2;
+
+    // A rank-1 kernel is the product of a column and a row, so it can run as two 1D passes
+    std::vector<float> vertical_weights;
+    std::vector<float> horizontal_weights;
+    if (FactorizeKernel(k, vertical_weights, horizontal_weights)) {
+        ApplySeparableKernel(source, dest, width, height, vertical_weights, horizontal_weights, offset);
+        return;
+    }
+
+    // Weights laid out in source order for the vectorized rows; the kernel rows are flipped vertically
+    std::vector<float, AlignedAllocator<float>> weights(k.Height() * k.Width());
+    for (int l = -vertical_radius; l <= vertical_radius; l++) {
+        for (int h = -horizontal_radius; h <= horizontal_radius; h++) {
+            weights[(2 * horizontal_radius + 1) * (l + vertical_radius) + (h + horizontal_radius)] = k(vertical_radius - l, h + horizontal_radius);
+        }
+    }
+    FilterSimd::Level level = FilterSimd::SupportedLevel();
+
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            unsigned int j = 0;
+            // Away from the border no tap needs clamping, so whole groups of pixels can be filtered at once
+            if ((int)i >= vertical_radius && (int)(i + vertical_radius) < (int)height && (int)width > 2 * horizontal_radius) {
+                for (; (int)j < horizontal_radius; j++) {
+                    FilterKernelPixel(source, dest, width, height, weights.data(), vertical_radius, horizontal_radius, offset, i, j);
+                }
+                j = FilterSimd::FilterRow(level, source, dest, width, i, j, width - horizontal_radius, weights.data(), vertical_radius, horizontal_radius, offset);
+            }
+            for (; j < width; j++) {
+                FilterKernelPixel(source, dest, width, height, weights.data(), vertical_radius, horizontal_radius, offset, i, j);
+            }
+        }
+    });
+}
+
+void Filter::ApplyGaussianBlur(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, float sigma, BlurMode mode) {
+    // EXTRA CREDIT: Implement this function
+    if (mode == BlurMode::Box) {
+        // Repeated box blurs converge to a gaussian, and each box costs the same whatever its width
+        std::vector<int> box_widths = GaussianBoxWidths(sigma);
+        // Pad by the combined reach of the boxes so every pass sees the clamped source edge rather than an already blurred one
+        int margin = 0;
+        for (int box_width : box_widths) {
+            margin += box_width / 2;
+        }
+        unsigned int padded_width = width + 2 * margin;
+        unsigned int padded_height = height + 2 * margin;
+        std::vector<float> image(3 * padded_width * padded_height);
+        std::vector<float> scratch(3 * padded_width * padded_height);
+        ThreadPool::Instance().ParallelFor(padded_height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+            for (unsigned int i = band_begin; i < band_end; i++) {
+                for (unsigned int j = 0; j < padded_width; j++) {
+                    const unsigned char* pixel = source + 4 * (ClampIndex((int)i - margin, height) * width + ClampIndex((int)j - margin, width));
+                    for (unsigned int p = 0; p < 3; p++) {
+                        image[3 * (i * padded_width + j) + p] = pixel[p];
                     }
                 }
-                int value = (int)filteredValue + offset;
-                if (value > 255) {
-                    value = 255;
+            }
+        });
+        for (int box_width : box_widths) {
+            BoxBlurRows(image.data(), scratch.data(), padded_width, padded_height, box_width / 2);
+            BoxBlurColumns(scratch.data(), image.data(), padded_width, padded_height, box_width / 2);
+        }
+        ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+            for (unsigned int i = band_begin; i < band_end; i++) {
+                for (unsigned int j = 0; j < width; j++) {
+                    const float* pixel = image.data() + 3 * ((i + margin) * padded_width + j + margin);
+                    for (unsigned int p = 0; p < 3; p++) {
+                        int value = (int)pixel[p];
+                        if (value > 255) {
+                            value = 255;
+                        }
+                        if (value < 0) {
+                            value = 0;
+                        }
+                        dest[4 * (i * width + j) + p] = value;
+                    }
+                    // Use origin value for alpha channel
+                    dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
                 }
-                if (value < 0) {
-                    value = 0;
+            }
+        });
+        return;
+    }
+
+    // The 2D gaussian is the product of two 1D gaussians, so blur the columns and then the rows
+    std::vector<float> weights = GaussianWeights(sigma);
+    ApplySeparableKernel(source, dest, width, height, weights, weights);
+}
+
+void Filter::ApplyToRegion(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, const ImageRegion &region, unsigned int halo, const ImageFilter &filter) {
+    unsigned int left = std::min(region.x, width);
+    unsigned int top = std::min(region.y, height);
+    unsigned int right = std::min(region.x + region.width, width);
+    unsigned int bottom = std::min(region.y + region.height, height);
+    if (left >= right || top >= bottom) return;
+
+    // The halo is cut off at the image edges, where the filter clamps the same way it does on the whole image
+    unsigned int crop_left = left > halo ? left - halo : 0;
+    unsigned int crop_top = top > halo ? top - halo : 0;
+    unsigned int crop_width = std::min(right + halo, width) - crop_left;
+    unsigned int crop_height = std::min(bottom + halo, height) - crop_top;
+
+    std::vector<unsigned char> crop(4 * crop_width * crop_height);
+    std::vector<unsigned char> filtered(4 * crop_width * crop_height);
+    for (unsigned int i = 0; i < crop_height; i++) {
+        memcpy(&crop[4 * i * crop_width], source + 4 * ((crop_top + i) * width + crop_left), 4 * crop_width);
+    }
+    filter(crop.data(), filtered.data(), crop_width, crop_height);
+    for (unsigned int i = top; i < bottom; i++) {
+        memcpy(dest + 4 * (i * width + left), &filtered[4 * ((i - crop_top) * crop_width + left - crop_left)], 4 * (right - left));
+    }
+}
+
+unsigned int Filter::FilterKernelHalo(const Kernel &k) {
+    return std::max(k.Height(), k.Width()) / 2;
+}
+
+unsigned int Filter::BilateralMeanHalo(unsigned int domain_half_width) {
+    return domain_half_width;
+}
+
+unsigned int Filter::BilateralGaussianHalo(float sigma_space, BilateralMode mode, float grid_cell_size) {
+    unsigned int radius = sigma_space * 3;
+    if (mode == BilateralMode::Grid) {
+        // Room for the slice to interpolate between cells on either side
+        radius += 2 * (unsigned int)std::ceil(std::max(1.0f, sigma_space * grid_cell_size));
+    }
+    return radius;
+}
+
+void Filter::ApplyBilateralMeanBlur(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, unsigned int domain_half_width, unsigned int range, BilateralMeanMode mode) {
+    if (mode == BilateralMeanMode::Histogram) {
+        ApplyBilateralMeanHistogram(source, dest, width, height, domain_half_width, range);
+        return;
+    }
+
+    // REQUIREMENT: Implement this function
+    int radius = domain_half_width;
+    unsigned int max_distance = range * range;
+    std::vector<unsigned int> columns = ClampedColumns(width, radius);
+
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            for (unsigned int j = 0; j < width; j++) {
+                const unsigned char* centre = source + 4 * (i * width + j);
+                unsigned int totalRValue = 0;
+                unsigned int totalGValue = 0;
+                unsigned int totalBValue = 0;
+                unsigned int count = 0;
+                for (int l = -radius; l <= radius; l++) {
+                    const unsigned char* row = source + 4 * ClampIndex((int)i + l, height) * width;
+                    for (int h = -radius; h <= radius; h++) {
+                        const unsigned char* pixel = row + 4 * columns[j + h + radius];
+                        // Sample solution uses range as one direction range, slides use range as both direction
+                        if (ColorDistance(centre, pixel) <= max_distance) {
+                            count++;
+                            totalRValue += pixel[0];
+                            totalGValue += pixel[1];
+                            totalBValue += pixel[2];
+                        }
+                    }
                 }
-                dest[4 * (i * width + j) + p] = value;
+                // Since the point itself must be in the range, so don't need to worry about divide by 0
+                dest[4 * (i * width + j)] = (int) (totalRValue / count);
+                dest[4 * (i * width + j) + 1] = (int) (totalGValue / count);
+                dest[4 * (i * width + j) + 2] = (int) (totalBValue / count);
+                // Use origin value for alpha channel
+                dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
             }
-            // Use origin value for alpha channel
-            dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
         }
-    }
+    });
 }
 
-void Filter::ApplyGaussianBlur(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, float sigma) {
-    unsigned int blur_radius = sigma * 3;
-    unsigned int kernel_size = blur_radius * 2 + 1;
+void Filter::ApplyBilateralGaussianBlur(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, float sigma_space, float sigma_range, BilateralMode mode, float grid_cell_size) {
+    if (mode == BilateralMode::Grid) {
+        ApplyBilateralGrid(source, dest, width, height, sigma_space, sigma_range, grid_cell_size);
+        return;
+    }
+
     // EXTRA CREDIT: Implement this function
-    int start = -1 * blur_radius;
-    int end = blur_radius;
-    for (unsigned int i = 0; i < height; i++) {
-        for (unsigned int j = 0; j < width; j++) {
-            for (unsigned int p = 0; p < 3; p++) {
-                float filteredValue = 0.0;
+    int radius = (unsigned int)(sigma_space * 3);
+    unsigned int kernel_size = radius * 2 + 1;
+    std::vector<unsigned int> columns = ClampedColumns(width, radius);
+
+    // Every weight the inner loop needs, computed once per call and shared by all threads:
+    // the spatial weight of each tap, and the range weight of every possible squared RGB distance
+    std::vector<float> space_weights(kernel_size * kernel_size);
+    for (int l = -radius; l <= radius; l++) {
+        for (int h = -radius; h <= radius; h++) {
+            space_weights[(l + radius) * kernel_size + h + radius] = exp(-((l * l + h * h) / (2 * sigma_space * sigma_space)));
+        }
+    }
+    std::vector<float> range_weights(MAX_COLOR_DISTANCE + 1);
+    for (unsigned int dist = 0; dist <= MAX_COLOR_DISTANCE; dist++) {
+        range_weights[dist] = exp(-(dist / (2 * sigma_range * sigma_range)));
+        // Far too small to change the result, but products with them go denormal and slow every tap down
+        if (range_weights[dist] < MIN_RANGE_WEIGHT) {
+            range_weights[dist] = 0.0f;
+        }
+    }
+
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            for (unsigned int j = 0; j < width; j++) {
+                const unsigned char* centre = source + 4 * (i * width + j);
+                unsigned int totalRValue = 0;
+                unsigned int totalGValue = 0;
+                unsigned int totalBValue = 0;
                 float totalWeight = 0.0;
-                for (int l = start; l <= end; l++) {
-                    for (int h = start; h <= end; h++) {
-                        float weight = exp(-((l * l + h * h) / (2 * sigma * sigma)));
+                const float* space_weight = space_weights.data();
+                for (int l = -radius; l <= radius; l++) {
+                    const unsigned char* row = source + 4 * ClampIndex((int)i + l, height) * width;
+                    for (int h = -radius; h <= radius; h++) {
+                        const unsigned char* pixel = row + 4 * columns[j + h + radius];
+                        float weight = *space_weight++ * range_weights[ColorDistance(centre, pixel)];
+                        totalRValue += pixel[0] * weight;
+                        totalGValue += pixel[1] * weight;
+                        totalBValue += pixel[2] * weight;
                         totalWeight += weight;
-                        filteredValue += weight * GetValue(source, i + l, j + h, width, height, p);
                     }
                 }
-                unsigned int value = (unsigned int)filteredValue / totalWeight;
-                dest[4 * (i * width + j) + p] = value;
+                dest[4 * (i * width + j)] = (int) (totalRValue / totalWeight);
+                dest[4 * (i * width + j) + 1] = (int) (totalGValue / totalWeight);
+                dest[4 * (i * width + j) + 2] = (int) (totalBValue / totalWeight);
+                // Use origin value for alpha channel
+                dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
             }
-            // Use origin value for alpha channel
-            dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
         }
+    });
+}
+
+void Filter::ApplyBilateralMeanHistogram(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, unsigned int domain_half_width, unsigned int range) {
+    int radius = domain_half_width;
+    // A grey step of d in every channel is an RGB distance of 3 d^2, so keep the luminance steps with 3 d^2 <= range^2
+    int luma_range = 0;
+    while (luma_range < 255 && 3 * (luma_range + 1) * (luma_range + 1) <= (int)(range * range)) {
+        luma_range++;
+    }
+
+    // Integer weights summing to 256, so grey pixels keep their value exactly
+    std::vector<unsigned char> luma(width * height);
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int k = band_begin * width; k < band_end * width; k++) {
+            luma[k] = (77 * source[4 * k] + 150 * source[4 * k + 1] + 29 * source[4 * k + 2] + 128) >> 8;
+        }
+    });
+
+    // Every band builds its column histograms from scratch, so make the bands several windows tall
+    unsigned int band_height = 4 * (2 * radius + 1);
+    if (band_height < ROW_BAND_HEIGHT) {
+        band_height = ROW_BAND_HEIGHT;
     }
+    // Two level histograms as in Perreault and Hebert's constant time median: the coarse level is kept current for every pixel,
+    // the fine level of a coarse bucket only catches up when a query needs part of that bucket.
+    const unsigned int fine_values = 4 * HISTOGRAM_BINS;
+    const unsigned int coarse_values = 4 * HISTOGRAM_BUCKETS;
+    const unsigned int bucket_bins = HISTOGRAM_BINS / HISTOGRAM_BUCKETS;
+    const unsigned int bucket_values = 4 * bucket_bins;
+    ThreadPool::Instance().ParallelFor(height, band_height, [&](unsigned int band_begin, unsigned int band_end) {
+        // For every column, the pixel count and summed r, g, b per luminance bin over rows [i - radius, i + radius].
+        // Sums may wrap while a pixel is being removed, but unsigned arithmetic brings them back.
+        std::vector<unsigned int> column_fine(width * fine_values, 0);
+        std::vector<unsigned int> column_coarse(width * coarse_values, 0);
+        std::vector<unsigned int> window_fine(fine_values);
+        std::vector<unsigned int> window_coarse(coarse_values);
+        // Column each fine bucket of the window was last brought up to, -1 if it is stale
+        std::vector<int> fine_column(HISTOGRAM_BUCKETS);
+
+        // Adds (sign 1) or removes (sign -1) a row of pixels from the column histograms
+        auto update_columns = [&](int row, unsigned int sign) {
+            const unsigned char* pixels = source + 4 * ClampIndex(row, height) * width;
+            const unsigned char* levels = luma.data() + ClampIndex(row, height) * width;
+            for (unsigned int j = 0; j < width; j++) {
+                unsigned int* fine = column_fine.data() + j * fine_values + 4 * levels[j];
+                unsigned int* coarse = column_coarse.data() + j * coarse_values + 4 * (levels[j] / bucket_bins);
+                for (unsigned int c = 0; c < 4; c++) {
+                    unsigned int value = c == 0 ? sign : sign * pixels[4 * j + c - 1];
+                    fine[c] += value;
+                    coarse[c] += value;
+                }
+            }
+        };
+
+        // Brings the fine bins of one bucket up to the window centred on column j
+        auto update_bucket = [&](unsigned int bucket, int j) {
+            unsigned int* window = window_fine.data() + bucket * bucket_values;
+            const unsigned int* columns = column_fine.data() + bucket * bucket_values;
+            if (fine_column[bucket] < 0 || j - fine_column[bucket] > 2 * radius + 1) {
+                // Too far behind, rebuilding is cheaper than sliding
+                std::fill(window, window + bucket_values, 0);
+                for (int h = -radius; h <= radius; h++) {
+                    const unsigned int* column = columns + ClampIndex(j + h, width) * fine_values;
+                    for (unsigned int b = 0; b < bucket_values; b++) {
+                        window[b] += column[b];
+                    }
+                }
+            } else {
+                for (int k = fine_column[bucket] + 1; k <= j; k++) {
+                    unsigned int entering = ClampIndex(k + radius, width);
+                    unsigned int leaving = ClampIndex(k - radius - 1, width);
+                    if (entering == leaving) continue;
+                    const unsigned int* added = columns + entering * fine_values;
+                    const unsigned int* removed = columns + leaving * fine_values;
+                    for (unsigned int b = 0; b < bucket_values; b++) {
+                        window[b] += added[b] - removed[b];
+                    }
+                }
+            }
+            fine_column[bucket] = j;
+        };
+
+        for (int l = -radius; l <= radius; l++) {
+            update_columns((int)band_begin + l, 1);
+        }
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            if (i > band_begin) {
+                update_columns((int)i - radius - 1, (unsigned int)-1);
+                update_columns((int)i + radius, 1);
+            }
+
+            // Coarse window for column 0, with the edge column counted once per clamped tap
+            std::fill(window_coarse.begin(), window_coarse.end(), 0);
+            for (int h = -radius; h <= radius; h++) {
+                const unsigned int* column = column_coarse.data() + ClampIndex(h, width) * coarse_values;
+                for (unsigned int b = 0; b < coarse_values; b++) {
+                    window_coarse[b] += column[b];
+                }
+            }
+            std::fill(fine_column.begin(), fine_column.end(), -1);
+
+            for (unsigned int j = 0; j < width; j++) {
+                if (j > 0) {
+                    // Slide right: the column entering replaces the one leaving
+                    unsigned int entering = ClampIndex((int)j + radius, width);
+                    unsigned int leaving = ClampIndex((int)j - radius - 1, width);
+                    if (entering != leaving) {
+                        const unsigned int* added = column_coarse.data() + entering * coarse_values;
+                        const unsigned int* removed = column_coarse.data() + leaving * coarse_values;
+                        for (unsigned int b = 0; b < coarse_values; b++) {
+                            window_coarse[b] += added[b] - removed[b];
+                        }
+                    }
+                }
+
+                int level = luma[i * width + j];
+                unsigned int lowest = std::max(0, level - luma_range);
+                unsigned int highest = std::min((int)HISTOGRAM_BINS - 1, level + luma_range);
+                unsigned int totals[4] = { 0, 0, 0, 0 };
+                unsigned int bin = lowest;
+                while (bin <= highest) {
+                    unsigned int bucket = bin / bucket_bins;
+                    unsigned int bucket_end = (bucket + 1) * bucket_bins - 1;
+                    if (bin == bucket * bucket_bins && bucket_end <= highest) {
+                        // Whole bucket in range
+                        for (unsigned int c = 0; c < 4; c++) {
+                            totals[c] += window_coarse[4 * bucket + c];
+                        }
+                        bin = bucket_end + 1;
+                    } else {
+                        update_bucket(bucket, j);
+                        unsigned int last = std::min(bucket_end, highest);
+                        for (; bin <= last; bin++) {
+                            for (unsigned int c = 0; c < 4; c++) {
+                                totals[c] += window_fine[4 * bin + c];
+                            }
+                        }
+                    }
+                }
+                // The pixel itself is always in its own bin, so the count is never 0
+                dest[4 * (i * width + j)] = totals[1] / totals[0];
+                dest[4 * (i * width + j) + 1] = totals[2] / totals[0];
+                dest[4 * (i * width + j) + 2] = totals[3] / totals[0];
+                // Use origin value for alpha channel
+                dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
+            }
+        }
+    });
 }
 
-void Filter::ApplyBilateralMeanBlur(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, unsigned int domain_half_width, unsigned int range) {
-    unsigned int kernel_size = domain_half_width * 2 + 1;
-    // REQUIREMENT: Implement this function
-    int start = -1 * domain_half_width;
-    int end = domain_half_width;
-
-    for (unsigned int i = 0; i < height; i++) {
-        for (unsigned int j = 0; j < width; j++) {
-            unsigned int totalRValue = 0;
-            unsigned int totalGValue = 0;
-            unsigned int totalBValue = 0;
-            unsigned int count = 0;
-            for (int l = start; l <= end; l++) {
-                for (int h = start; h <= end; h++) {
-                    if (isPointInRange(source, i, j, l, h, range, width, height)) {
-                        count++;
-                        totalRValue += GetValue(source, i + l, j + h, width, height, 0);
-                        totalGValue += GetValue(source, i + l, j + h, width, height, 1);
-                        totalBValue += GetValue(source, i + l, j + h, width, height, 2);
+void Filter::ApplyBilateralGrid(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, float sigma_space, float sigma_range, float cell_size) {
+    // A grey step of d in every channel is an RGB distance of 3 d^2, so the matching luminance sigma is sigma_range / sqrt(3)
+    float luma_sigma = sigma_range / sqrt(3.0f);
+    float space_cell = std::max(1.0f, sigma_space * cell_size);
+    float range_cell = std::max(1.0f, luma_sigma * cell_size);
+
+    // Coarsen the grid until it fits the cell budget
+    std::vector<float> space_weights;
+    std::vector<float> range_weights;
+    int space_pad;
+    int range_pad;
+    unsigned int grid_width;
+    unsigned int grid_height;
+    unsigned int grid_depth;
+    while (true) {
+        space_weights = GaussianWeights(sigma_space / space_cell);
+        range_weights = GaussianWeights(luma_sigma / range_cell);
+        // Room for the blur to spread and for the slice to interpolate past the last occupied cell
+        space_pad = space_weights.size() / 2 + 1;
+        range_pad = range_weights.size() / 2 + 1;
+        grid_width = (unsigned int)((width - 1) / space_cell + 0.5f) + 1 + 2 * space_pad;
+        grid_height = (unsigned int)((height - 1) / space_cell + 0.5f) + 1 + 2 * space_pad;
+        grid_depth = (unsigned int)(255 / range_cell + 0.5f) + 1 + 2 * range_pad;
+        if ((double)grid_width * grid_height * grid_depth <= MAX_GRID_CELLS) {
+            break;
+        }
+        space_cell *= 1.25f;
+        range_cell *= 1.25f;
+    }
+
+    std::vector<float> luma(width * height);
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int k = band_begin * width; k < band_end * width; k++) {
+            luma[k] = 0.299f * source[4 * k] + 0.587f * source[4 * k + 1] + 0.114f * source[4 * k + 2];
+        }
+    });
+
+    // Each cell holds the summed r, g, b of the pixels that landed in it, and their count
+    std::vector<float> grid(4 * grid_width * grid_height * grid_depth, 0.0f);
+
+    // Splat: every pixel goes to its nearest cell. Grid rows are split between threads, so each one owns the image rows rounding to it.
+    std::vector<unsigned int> first_row(grid_height + 1, height);
+    for (int i = height - 1; i >= 0; i--) {
+        first_row[(unsigned int)(i / space_cell + 0.5f) + space_pad] = i;
+    }
+    for (int gy = grid_height - 1; gy >= 0; gy--) {
+        first_row[gy] = std::min(first_row[gy], first_row[gy + 1]);
+    }
+    ThreadPool::Instance().ParallelFor(grid_height, 1, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int gy = band_begin; gy < band_end; gy++) {
+            for (unsigned int i = first_row[gy]; i < first_row[gy + 1]; i++) {
+                for (unsigned int j = 0; j < width; j++) {
+                    unsigned int gx = (unsigned int)(j / space_cell + 0.5f) + space_pad;
+                    unsigned int gz = (unsigned int)(luma[i * width + j] / range_cell + 0.5f) + range_pad;
+                    float* cell = grid.data() + 4 * ((gy * grid_width + gx) * grid_depth + gz);
+                    const unsigned char* pixel = source + 4 * (i * width + j);
+                    cell[0] += pixel[0];
+                    cell[1] += pixel[1];
+                    cell[2] += pixel[2];
+                    cell[3] += 1.0f;
+                }
+            }
+        }
+    });
+
+    // Blur: the 3D gaussian is separable, one axis at a time
+    unsigned int row_stride = 4 * grid_width * grid_depth;
+    ThreadPool::Instance().ParallelFor(grid_height, 1, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int gy = band_begin; gy < band_end; gy++) {
+            float* grid_row = grid.data() + gy * row_stride;
+            BlurGridLines(grid_row, grid_depth, 4, grid_width, 4 * grid_depth, space_weights);
+            BlurGridLines(grid_row, grid_width, 4 * grid_depth, grid_depth, 4, range_weights);
+        }
+    });
+    ThreadPool::Instance().ParallelFor(grid_width, 1, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int gx = band_begin; gx < band_end; gx++) {
+            BlurGridLines(grid.data() + 4 * gx * grid_depth, grid_depth, 4, grid_height, row_stride, space_weights);
+        }
+    });
+
+    // Slice: trilinearly interpolate the blurred grid at each pixel's position and luminance
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            float fy = i / space_cell + space_pad;
+            unsigned int y0 = fy;
+            float ty = fy - y0;
+            for (unsigned int j = 0; j < width; j++) {
+                float fx = j / space_cell + space_pad;
+                float fz = luma[i * width + j] / range_cell + range_pad;
+                unsigned int x0 = fx;
+                unsigned int z0 = fz;
+                float tx = fx - x0;
+                float tz = fz - z0;
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (unsigned int corner = 0; corner < 8; corner++) {
+                    unsigned int dx = corner & 1;
+                    unsigned int dy = (corner >> 1) & 1;
+                    unsigned int dz = corner >> 2;
+                    float weight = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty) * (dz ? tz : 1 - tz);
+                    const float* cell = grid.data() + 4 * (((y0 + dy) * grid_width + x0 + dx) * grid_depth + z0 + dz);
+                    for (unsigned int p = 0; p < 4; p++) {
+                        sum[p] += weight * cell[p];
+                    }
+                }
+                for (unsigned int p = 0; p < 3; p++) {
+                    // The pixel's own splat keeps the weight positive, but guard against underflow anyway
+                    int value = sum[3] > 0.0f ? (int)(sum[p] / sum[3]) : source[4 * (i * width + j) + p];
+                    if (value > 255) {
+                        value = 255;
                     }
+                    dest[4 * (i * width + j) + p] = value;
+                }
+                // Use origin value for alpha channel
+                dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
+            }
+        }
+    });
+}
+
+void Filter::BlurGridLines(float *grid, unsigned int count, unsigned int line_stride, unsigned int length, unsigned int sample_stride, const std::vector<float>& weights) {
+    int radius = weights.size() / 2;
+    std::vector<float> line(4 * length);
+    for (unsigned int n = 0; n < count; n++) {
+        float* start = grid + n * line_stride;
+        for (unsigned int t = 0; t < length; t++) {
+            for (unsigned int p = 0; p < 4; p++) {
+                line[4 * t + p] = start[t * sample_stride + p];
+            }
+        }
+        for (int t = 0; t < (int)length; t++) {
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (int h = std::max(-radius, -t); h <= radius && t + h < (int)length; h++) {
+                for (unsigned int p = 0; p < 4; p++) {
+                    sum[p] += weights[h + radius] * line[4 * (t + h) + p];
                 }
             }
-            // Since the point itself must be in the range, so don't need to worry about divide by 0
-            dest[4 * (i * width + j)] = (int) (totalRValue / count);
-            dest[4 * (i * width + j) + 1] = (int) (totalGValue / count);
-            dest[4 * (i * width + j) + 2] = (int) (totalBValue / count);
-            // Use origin value for alpha channel
-            dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
+            for (unsigned int p = 0; p < 4; p++) {
+                start[t * sample_stride + p] = sum[p];
+            }
         }
     }
 }
 
-void Filter::ApplyBilateralGaussianBlur(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, float sigma_space, float sigma_range) {
-    unsigned int kernel_radius = sigma_space * 3;
-    unsigned int kernel_size = kernel_radius * 2 + 1;
-    // EXTRA CREDIT: Implement this function
+void Filter::ApplySeparableKernel(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, const std::vector<float>& vertical_weights, const std::vector<float>& horizontal_weights, int offset) {
+    int vertical_radius = vertical_weights.size() / 2;
+    int horizontal_radius = horizontal_weights.size() / 2;
 
-    int start = -1 * kernel_radius;
-    int end = kernel_radius;
-    for (unsigned int i = 0; i < height; i++) {
-        for (unsigned int j = 0; j < width; j++) {
-            unsigned int totalRValue = 0;
-            unsigned int totalGValue = 0;
-            unsigned int totalBValue = 0;
-            float totalWeight = 0.0;
-            for (int l = start; l <= end; l++) {
-                for (int h = start; h <= end; h++) {
-                    int dist = rangeDist(source, i, j, l, h, width, height);
-                    float weight = exp(-((l * l + h * h) / (2 * sigma_space * sigma_space))) * exp(-(dist / (2 * sigma_range * sigma_range)));
-                    totalRValue += GetValue(source, i + l, j + h, width, height, 0) * weight;
-                    totalGValue += GetValue(source, i + l, j + h, width, height, 1) * weight;
-                    totalBValue += GetValue(source, i + l, j + h, width, height, 2) * weight;
-                    totalWeight += weight;
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        // Vertically filtered RGB values of one row, padded on both sides with copies of the edge pixels
+        std::vector<float> row_buffer(3 * (width + 2 * horizontal_radius));
+        float* row = row_buffer.data() + 3 * horizontal_radius;
 
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            // Vertical pass
+            std::fill(row_buffer.begin(), row_buffer.end(), 0.0f);
+            for (int l = -vertical_radius; l <= vertical_radius; l++) {
+                const unsigned char* source_row = source + 4 * width * ClampIndex((int)i + l, height);
+                float weight = vertical_weights[l + vertical_radius];
+                for (unsigned int j = 0; j < width; j++) {
+                    row[3 * j] += weight * source_row[4 * j];
+                    row[3 * j + 1] += weight * source_row[4 * j + 1];
+                    row[3 * j + 2] += weight * source_row[4 * j + 2];
+                }
+            }
+            for (int h = 1; h <= horizontal_radius; h++) {
+                for (int p = 0; p < 3; p++) {
+                    row[-3 * h + p] = row[p];
+                    row[3 * (width - 1 + h) + p] = row[3 * (width - 1) + p];
                 }
             }
-            dest[4 * (i * width + j)] = (int) (totalRValue / totalWeight);
-            dest[4 * (i * width + j) + 1] = (int) (totalGValue / totalWeight);
-            dest[4 * (i * width + j) + 2] = (int) (totalBValue / totalWeight);
-            // Use origin value for alpha channel
-            dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
+
+            // Horizontal pass
+            unsigned char* dest_row = dest + 4 * width * i;
+            for (unsigned int j = 0; j < width; j++) {
+                // Leftmost pixel of the horizontal window centred on column j
+                const float* window = row + 3 * ((int)j - horizontal_radius);
+                for (unsigned int p = 0; p < 3; p++) {
+                    float filteredValue = 0.0;
+                    for (unsigned int h = 0; h < horizontal_weights.size(); h++) {
+                        filteredValue += window[3 * h + p] * horizontal_weights[h];
+                    }
+                    int value = (int)filteredValue + offset;
+                    if (value > 255) {
+                        value = 255;
+                    }
+                    if (value < 0) {
+                        value = 0;
+                    }
+                    dest_row[4 * j + p] = value;
+                }
+                // Use origin value for alpha channel
+                dest_row[4 * j + 3] = source[4 * (i * width + j) + 3];
+            }
+        }
+    });
+}
+
+void Filter::FilterKernelPixel(const unsigned char *source, unsigned char *dest, unsigned int width, unsigned int height, const float *weights, int vertical_radius, int horizontal_radius, int offset, unsigned int i, unsigned int j) {
+    // Use calculated value for r,g,b channel
+    for (unsigned int p = 0; p < 3; p++) {
+        float filteredValue = 0.0;
+        const float* weight = weights;
+        for (int l = -vertical_radius; l <= vertical_radius; l++) {
+            for (int h = -horizontal_radius; h <= horizontal_radius; h++) {
+                filteredValue += GetValue(source, i + l, j + h, width, height, p) * *weight++;
+            }
+        }
+        int value = (int)filteredValue + offset;
+        if (value > 255) {
+            value = 255;
+        }
+        if (value < 0) {
+            value = 0;
+        }
+        dest[4 * (i * width + j) + p] = value;
+    }
+    // Use origin value for alpha channel
+    dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
+}
+
+bool Filter::FactorizeKernel(const Kernel &k, std::vector<float> &vertical_weights, std::vector<float> &horizontal_weights) {
+    unsigned int rows = k.Height();
+    unsigned int columns = k.Width();
+
+    // Pivot on the largest entry to keep the division well conditioned
+    unsigned int pivot_row = 0;
+    unsigned int pivot_column = 0;
+    float largest = 0.0;
+    for (unsigned int r = 0; r < rows; r++) {
+        for (unsigned int c = 0; c < columns; c++) {
+            if (fabs(k(r, c)) > largest) {
+                largest = fabs(k(r, c));
+                pivot_row = r;
+                pivot_column = c;
+            }
         }
     }
+    // An all zero kernel is trivially separable, but there is nothing to gain
+    if (largest == 0.0) {
+        return false;
+    }
+
+    // If the kernel is rank 1, it equals its pivot column times its pivot row scaled by the pivot
+    std::vector<float> column(rows);
+    std::vector<float> row(columns);
+    for (unsigned int r = 0; r < rows; r++) {
+        column[r] = k(r, pivot_column);
+    }
+    for (unsigned int c = 0; c < columns; c++) {
+        row[c] = k(pivot_row, c) / k(pivot_row, pivot_column);
+    }
+    const float tolerance = 1e-5f * largest;
+    for (unsigned int r = 0; r < rows; r++) {
+        for (unsigned int c = 0; c < columns; c++) {
+            if (fabs(k(r, c) - column[r] * row[c]) > tolerance) {
+                return false;
+            }
+        }
+    }
+
+    // Kernel rows are flipped vertically relative to the source rows, columns are not
+    vertical_weights.assign(column.rbegin(), column.rend());
+    horizontal_weights = row;
+    return true;
+}
+
+unsigned int Filter::ClampIndex(int index, unsigned int size) {
+    if (index < 0) {
+        return 0;
+    }
+    if (index >= (int)size) {
+        return size - 1;
+    }
+    return index;
+}
+
+std::vector<float> Filter::GaussianWeights(float sigma) {
+    int radius = sigma * 3;
+    std::vector<float> weights(2 * radius + 1);
+    float totalWeight = 0.0;
+    for (int l = -radius; l <= radius; l++) {
+        weights[l + radius] = exp(-((l * l) / (2 * sigma * sigma)));
+        totalWeight += weights[l + radius];
+    }
+    for (float& weight : weights) {
+        weight /= totalWeight;
+    }
+    return weights;
+}
+
+std::vector<int> Filter::GaussianBoxWidths(float sigma) {
+    // Ideal box width for n boxes is sqrt(12 sigma^2 / n + 1); mix the nearest odd widths below and above it so the variance matches
+    const int n = 3;
+    int lower = sqrt(12 * sigma * sigma / n + 1);
+    if (lower % 2 == 0) {
+        lower--;
+    }
+    int upper = lower + 2;
+    int lower_count = round((12 * sigma * sigma - n * lower * lower - 4 * n * lower - 3 * n) / (-4 * lower - 4));
+    std::vector<int> widths(n);
+    for (int b = 0; b < n; b++) {
+        widths[b] = b < lower_count ? lower : upper;
+    }
+    return widths;
+}
 
+void Filter::BoxBlurRows(const float *source, float *dest, unsigned int width, unsigned int height, int radius) {
+    float scale = 1.0f / (2 * radius + 1);
+    ThreadPool::Instance().ParallelFor(height, ROW_BAND_HEIGHT, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            const float* source_row = source + 3 * width * i;
+            float* dest_row = dest + 3 * width * i;
+            for (unsigned int p = 0; p < 3; p++) {
+                // Sum of the window centred on the first pixel, edges clamped
+                float sum = 0.0;
+                for (int h = -radius; h <= radius; h++) {
+                    sum += source_row[3 * ClampIndex(h, width) + p];
+                }
+                dest_row[p] = sum * scale;
+                // Slide the window one pixel at a time
+                for (int j = 1; j < (int)width; j++) {
+                    sum += source_row[3 * ClampIndex(j + radius, width) + p] - source_row[3 * ClampIndex(j - radius - 1, width) + p];
+                    dest_row[3 * j + p] = sum * scale;
+                }
+            }
+        }
+    });
+}
+
+void Filter::BoxBlurColumns(const float *source, float *dest, unsigned int width, unsigned int height, int radius) {
+    float scale = 1.0f / (2 * radius + 1);
+    // Each band restarts its running sums, so band boundaries must not depend on the thread count.
+    // Bands at least as tall as the window keep the restart cost below the sliding cost.
+    unsigned int band_height = 2 * radius + 1;
+    if (band_height < ROW_BAND_HEIGHT) {
+        band_height = ROW_BAND_HEIGHT;
+    }
+    ThreadPool::Instance().ParallelFor(height, band_height, [&](unsigned int band_begin, unsigned int band_end) {
+        // Running column sums for a whole row, so the image is walked row by row
+        std::vector<float> sums(3 * width, 0.0f);
+        for (int l = -radius; l <= radius; l++) {
+            const float* source_row = source + 3 * width * ClampIndex((int)band_begin + l, height);
+            for (unsigned int k = 0; k < 3 * width; k++) {
+                sums[k] += source_row[k];
+            }
+        }
+        for (int i = band_begin; i < (int)band_end; i++) {
+            if (i > (int)band_begin) {
+                const float* entering = source + 3 * width * ClampIndex(i + radius, height);
+                const float* leaving = source + 3 * width * ClampIndex(i - radius - 1, height);
+                for (unsigned int k = 0; k < 3 * width; k++) {
+                    sums[k] += entering[k] - leaving[k];
+                }
+            }
+            float* dest_row = dest + 3 * width * i;
+            for (unsigned int k = 0; k < 3 * width; k++) {
+                dest_row[k] = sums[k] * scale;
+            }
+        }
+    });
 }
 
 unsigned int Filter::GetValue(const unsigned char *source, int i, int j, unsigned int width, unsigned int height, unsigned int p) {
@@ -136,23 +770,19 @@ unsigned int Filter::GetValue(const unsigned char *source, int i, int j, unsigne
     return source[4 * (i * width + j) + p];
 }
 
-bool Filter::isPointInRange(const unsigned char *source, unsigned int i, unsigned int j, int l, int h, int range, unsigned int width, unsigned int height) {
+unsigned int Filter::ColorDistance(const unsigned char *first, const unsigned char *second) {
     int difference = 0;
     for (int p = 0; p < 3; p++) {
-        int sourceValue = GetValue(source, i, j, width, height, p);
-        int destValue = GetValue(source, i + l, j + h, width, height, p);
-        difference += (sourceValue - destValue) * (sourceValue - destValue) ;
+        int channel_difference = first[p] - second[p];
+        difference += channel_difference * channel_difference;
     }
-    // Sample solution uses range as one direction range, slides use range as both direction
-    return difference <= range * range;
+    return difference;
 }
 
-int Filter::rangeDist(const unsigned char *source, unsigned int i, unsigned int j, int l, int h, unsigned int width, unsigned int height) {
-    int difference = 0;
-    for (int p = 0; p < 3; p++) {
-        int sourceValue = GetValue(source, i, j, width, height, p);
-        int destValue = GetValue(source, i + l, j + h, width, height, p);
-        difference += (sourceValue - destValue) * (sourceValue - destValue) ;
+std::vector<unsigned int> Filter::ClampedColumns(unsigned int width, int radius) {
+    std::vector<unsigned int> columns(width + 2 * radius);
+    for (int j = -radius; j < (int)width + radius; j++) {
+        columns[j + radius] = ClampIndex(j, width);
     }
-    return difference;
+    return columns;
 }
@@ -0,0 +1,339 @@
+#include "filtersimd.h"
+
+// Asks the compiler to fully unroll the loop that follows; with fixed radii the trip counts are compile time constants
+#if defined(__clang__)
+    #define FILTER_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+    #define FILTER_UNROLL _Pragma("GCC unroll 16")
+#else
+    #define FILTER_UNROLL
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define FILTER_SIMD_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+        // MSVC lets any function use any intrinsic
+        #define FILTER_SIMD_TARGET(isa)
+    #else
+        // GCC and Clang compile single functions for a wider instruction set than the rest of the build
+        #define FILTER_SIMD_TARGET(isa) __attribute__((target(isa)))
+    #endif
+#endif
+
+FilterSimd::Level FilterSimd::SupportedLevel() {
+#ifdef FILTER_SIMD_X86
+    static const Level level = []() {
+    #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        bool sse41 = (info[2] & (1 << 19)) != 0;
+        // AVX also needs the OS to save the YMM registers
+        bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+        bool avx2 = false;
+        if (avx && max_leaf >= 7) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+    #else
+        __builtin_cpu_init();
+        bool sse41 = __builtin_cpu_supports("sse4.1");
+        bool avx2 = __builtin_cpu_supports("avx2");
+    #endif
+        if (avx2) return Level::AVX2;
+        if (sse41) return Level::SSE41;
+        return Level::Scalar;
+    }();
+    return level;
+#else
+    return Level::Scalar;
+#endif
+}
+
+// Weights of LuminanceRow
+static const float LUMINANCE_RED = 0.299f;
+static const float LUMINANCE_GREEN = 0.587f;
+static const float LUMINANCE_BLUE = 0.114f;
+
+#ifdef FILTER_SIMD_X86
+
+// Taps are accumulated in the same order and with separate multiply and add as the scalar path,
+// then truncated, offset and saturated to [0, 255] by the packs.
+
+template<int FixedVerticalRadius, int FixedHorizontalRadius>
+FILTER_SIMD_TARGET("sse4.1")
+static unsigned int FilterRowSSE41(const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int i,
+                                   unsigned int begin, unsigned int end, const float* weights, int vertical_radius, int horizontal_radius, int offset) {
+    const __m128i offsets = _mm_set1_epi32(offset);
+    const __m128i alpha_mask = _mm_set1_epi32(0xFF000000);
+    if (FixedVerticalRadius >= 0) vertical_radius = FixedVerticalRadius;
+    if (FixedHorizontalRadius >= 0) horizontal_radius = FixedHorizontalRadius;
+    unsigned int j = begin;
+    for (; j + 4 <= end; j += 4) {
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        __m128 acc2 = _mm_setzero_ps();
+        __m128 acc3 = _mm_setzero_ps();
+        const float* tap_weight = weights;
+        FILTER_UNROLL
+        for (int l = -vertical_radius; l <= vertical_radius; l++) {
+            const unsigned char* row = source + 4 * ((i + l) * width + j);
+            FILTER_UNROLL
+            for (int h = -horizontal_radius; h <= horizontal_radius; h++) {
+                __m128 weight = _mm_set1_ps(*tap_weight++);
+                __m128i pixels = _mm_loadu_si128((const __m128i*)(row + 4 * h));
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(pixels)), weight));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(pixels, 4))), weight));
+                acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(pixels, 8))), weight));
+                acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(pixels, 12))), weight));
+            }
+        }
+        __m128i low = _mm_packs_epi32(_mm_add_epi32(_mm_cvttps_epi32(acc0), offsets), _mm_add_epi32(_mm_cvttps_epi32(acc1), offsets));
+        __m128i high = _mm_packs_epi32(_mm_add_epi32(_mm_cvttps_epi32(acc2), offsets), _mm_add_epi32(_mm_cvttps_epi32(acc3), offsets));
+        __m128i result = _mm_packus_epi16(low, high);
+        // Use origin value for alpha channel
+        __m128i centre = _mm_loadu_si128((const __m128i*)(source + 4 * (i * width + j)));
+        result = _mm_blendv_epi8(result, centre, alpha_mask);
+        _mm_storeu_si128((__m128i*)(dest + 4 * (i * width + j)), result);
+    }
+    return j;
+}
+
+template<int FixedVerticalRadius, int FixedHorizontalRadius>
+FILTER_SIMD_TARGET("avx2")
+static unsigned int FilterRowAVX2(const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int i,
+                                  unsigned int begin, unsigned int end, const float* weights, int vertical_radius, int horizontal_radius, int offset) {
+    const __m256i offsets = _mm256_set1_epi32(offset);
+    const __m256i alpha_mask = _mm256_set1_epi32(0xFF000000);
+    // Undoes the lane interleaving of the 256 bit packs
+    const __m256i pixel_order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    if (FixedVerticalRadius >= 0) vertical_radius = FixedVerticalRadius;
+    if (FixedHorizontalRadius >= 0) horizontal_radius = FixedHorizontalRadius;
+    unsigned int j = begin;
+    for (; j + 8 <= end; j += 8) {
+        // Each accumulator holds two pixels
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps();
+        __m256 acc3 = _mm256_setzero_ps();
+        const float* tap_weight = weights;
+        FILTER_UNROLL
+        for (int l = -vertical_radius; l <= vertical_radius; l++) {
+            const unsigned char* row = source + 4 * ((i + l) * width + j);
+            FILTER_UNROLL
+            for (int h = -horizontal_radius; h <= horizontal_radius; h++) {
+                __m256 weight = _mm256_set1_ps(*tap_weight++);
+                const unsigned char* pixels = row + 4 * h;
+                acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)pixels))), weight));
+                acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pixels + 8)))), weight));
+                acc2 = _mm256_add_ps(acc2, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pixels + 16)))), weight));
+                acc3 = _mm256_add_ps(acc3, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(pixels + 24)))), weight));
+            }
+        }
+        __m256i low = _mm256_packs_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(acc0), offsets), _mm256_add_epi32(_mm256_cvttps_epi32(acc1), offsets));
+        __m256i high = _mm256_packs_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(acc2), offsets), _mm256_add_epi32(_mm256_cvttps_epi32(acc3), offsets));
+        __m256i result = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(low, high), pixel_order);
+        // Use origin value for alpha channel
+        __m256i centre = _mm256_loadu_si256((const __m256i*)(source + 4 * (i * width + j)));
+        result = _mm256_blendv_epi8(result, centre, alpha_mask);
+        _mm256_storeu_si256((__m256i*)(dest + 4 * (i * width + j)), result);
+    }
+    return j;
+}
+
+// The luminance and Sobel sums are evaluated in the same order as the scalar loops, so every level gives the same floats
+
+FILTER_SIMD_TARGET("sse4.1")
+static unsigned int LuminanceRowSSE41(const unsigned char* source, float* dest, unsigned int count) {
+    const __m128i channel_mask = _mm_set1_epi32(0xFF);
+    const __m128 red = _mm_set1_ps(LUMINANCE_RED);
+    const __m128 green = _mm_set1_ps(LUMINANCE_GREEN);
+    const __m128 blue = _mm_set1_ps(LUMINANCE_BLUE);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    unsigned int k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(source + 4 * k));
+        __m128 r = _mm_cvtepi32_ps(_mm_and_si128(pixels, channel_mask));
+        __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), channel_mask));
+        __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 16), channel_mask));
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(red, r), _mm_mul_ps(green, g)), _mm_mul_ps(blue, b));
+        _mm_storeu_ps(dest + k, _mm_div_ps(sum, scale));
+    }
+    return k;
+}
+
+FILTER_SIMD_TARGET("avx2")
+static unsigned int LuminanceRowAVX2(const unsigned char* source, float* dest, unsigned int count) {
+    const __m256i channel_mask = _mm256_set1_epi32(0xFF);
+    const __m256 red = _mm256_set1_ps(LUMINANCE_RED);
+    const __m256 green = _mm256_set1_ps(LUMINANCE_GREEN);
+    const __m256 blue = _mm256_set1_ps(LUMINANCE_BLUE);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    unsigned int k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(source + 4 * k));
+        __m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(pixels, channel_mask));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), channel_mask));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 16), channel_mask));
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(red, r), _mm256_mul_ps(green, g)), _mm256_mul_ps(blue, b));
+        _mm256_storeu_ps(dest + k, _mm256_div_ps(sum, scale));
+    }
+    return k;
+}
+
+FILTER_SIMD_TARGET("sse4.1")
+static unsigned int SobelRowSSE41(const float* source, float* gx, float* gy, unsigned int width, unsigned int i, unsigned int begin, unsigned int end) {
+    const __m128 two = _mm_set1_ps(2.0f);
+    const float* top = source + (i - 1) * width;
+    const float* middle = source + i * width;
+    const float* bottom = source + (i + 1) * width;
+    unsigned int j = begin;
+    for (; j + 4 <= end; j += 4) {
+        __m128 t0 = _mm_loadu_ps(top + j - 1), t1 = _mm_loadu_ps(top + j), t2 = _mm_loadu_ps(top + j + 1);
+        __m128 m0 = _mm_loadu_ps(middle + j - 1), m2 = _mm_loadu_ps(middle + j + 1);
+        __m128 b0 = _mm_loadu_ps(bottom + j - 1), b1 = _mm_loadu_ps(bottom + j), b2 = _mm_loadu_ps(bottom + j + 1);
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_sub_ps(t2, t0), _mm_mul_ps(two, _mm_sub_ps(m2, m0))), _mm_sub_ps(b2, b0));
+        __m128 y = _mm_sub_ps(_mm_add_ps(_mm_add_ps(t0, _mm_mul_ps(two, t1)), t2), _mm_add_ps(_mm_add_ps(b0, _mm_mul_ps(two, b1)), b2));
+        _mm_storeu_ps(gx + i * width + j, x);
+        _mm_storeu_ps(gy + i * width + j, y);
+    }
+    return j;
+}
+
+FILTER_SIMD_TARGET("avx2")
+static unsigned int SobelRowAVX2(const float* source, float* gx, float* gy, unsigned int width, unsigned int i, unsigned int begin, unsigned int end) {
+    const __m256 two = _mm256_set1_ps(2.0f);
+    const float* top = source + (i - 1) * width;
+    const float* middle = source + i * width;
+    const float* bottom = source + (i + 1) * width;
+    unsigned int j = begin;
+    for (; j + 8 <= end; j += 8) {
+        __m256 t0 = _mm256_loadu_ps(top + j - 1), t1 = _mm256_loadu_ps(top + j), t2 = _mm256_loadu_ps(top + j + 1);
+        __m256 m0 = _mm256_loadu_ps(middle + j - 1), m2 = _mm256_loadu_ps(middle + j + 1);
+        __m256 b0 = _mm256_loadu_ps(bottom + j - 1), b1 = _mm256_loadu_ps(bottom + j), b2 = _mm256_loadu_ps(bottom + j + 1);
+        __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(t2, t0), _mm256_mul_ps(two, _mm256_sub_ps(m2, m0))), _mm256_sub_ps(b2, b0));
+        __m256 y = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(t0, _mm256_mul_ps(two, t1)), t2), _mm256_add_ps(_mm256_add_ps(b0, _mm256_mul_ps(two, b1)), b2));
+        _mm256_storeu_ps(gx + i * width + j, x);
+        _mm256_storeu_ps(gy + i * width + j, y);
+    }
+    return j;
+}
+
+#endif
+
+// Same sums as Filter::FilterKernelPixel without the edge clamping
+template<int FixedVerticalRadius, int FixedHorizontalRadius>
+static unsigned int FilterRowScalar(const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int i,
+                                    unsigned int begin, unsigned int end, const float* weights, int vertical_radius, int horizontal_radius, int offset) {
+    if (FixedVerticalRadius >= 0) vertical_radius = FixedVerticalRadius;
+    if (FixedHorizontalRadius >= 0) horizontal_radius = FixedHorizontalRadius;
+    for (unsigned int j = begin; j < end; j++) {
+        for (unsigned int p = 0; p < 3; p++) {
+            float filteredValue = 0.0;
+            const float* tap_weight = weights;
+            FILTER_UNROLL
+            for (int l = -vertical_radius; l <= vertical_radius; l++) {
+                const unsigned char* row = source + 4 * ((i + l) * width + j) + p;
+                FILTER_UNROLL
+                for (int h = -horizontal_radius; h <= horizontal_radius; h++) {
+                    filteredValue += row[4 * h] * *tap_weight++;
+                }
+            }
+            int value = (int)filteredValue + offset;
+            if (value > 255) {
+                value = 255;
+            }
+            if (value < 0) {
+                value = 0;
+            }
+            dest[4 * (i * width + j) + p] = value;
+        }
+        // Use origin value for alpha channel
+        dest[4 * (i * width + j) + 3] = source[4 * (i * width + j) + 3];
+    }
+    return end;
+}
+
+template<int FixedVerticalRadius, int FixedHorizontalRadius>
+static unsigned int FilterRowAt(FilterSimd::Level level, const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int i,
+                                unsigned int begin, unsigned int end, const float* weights, int vertical_radius, int horizontal_radius, int offset) {
+    switch (level) {
+#ifdef FILTER_SIMD_X86
+        case FilterSimd::Level::AVX2:
+            begin = FilterRowAVX2<FixedVerticalRadius, FixedHorizontalRadius>(source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+            break;
+        case FilterSimd::Level::SSE41:
+            begin = FilterRowSSE41<FixedVerticalRadius, FixedHorizontalRadius>(source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+            break;
+#endif
+        default:
+            break;
+    }
+    // Columns left over after the last full vector
+    return FilterRowScalar<FixedVerticalRadius, FixedHorizontalRadius>(source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+}
+
+unsigned int FilterSimd::FilterRow(Level level, const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int i,
+                                   unsigned int begin, unsigned int end, const float* weights, int vertical_radius, int horizontal_radius, int offset) {
+    // The common square kernels get their own instantiations with the loop bounds fixed at compile time
+    if (vertical_radius == horizontal_radius) {
+        switch (vertical_radius) {
+            case 1:
+                return FilterRowAt<1, 1>(level, source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+            case 2:
+                return FilterRowAt<2, 2>(level, source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+            case 3:
+                return FilterRowAt<3, 3>(level, source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+        }
+    }
+    // -1 leaves the radii to runtime
+    return FilterRowAt<-1, -1>(level, source, dest, width, i, begin, end, weights, vertical_radius, horizontal_radius, offset);
+}
+
+void FilterSimd::LuminanceRow(Level level, const unsigned char* source, float* dest, unsigned int count) {
+    unsigned int k = 0;
+    switch (level) {
+#ifdef FILTER_SIMD_X86
+        case Level::AVX2:
+            k = LuminanceRowAVX2(source, dest, count);
+            break;
+        case Level::SSE41:
+            k = LuminanceRowSSE41(source, dest, count);
+            break;
+#endif
+        default:
+            break;
+    }
+    // Pixels left over after the last full vector
+    for (; k < count; k++) {
+        const unsigned char* pixel = source + 4 * k;
+        dest[k] = (LUMINANCE_RED * pixel[0] + LUMINANCE_GREEN * pixel[1] + LUMINANCE_BLUE * pixel[2]) / 255.0f;
+    }
+}
+
+void FilterSimd::SobelRow(Level level, const float* source, float* gx, float* gy, unsigned int width, unsigned int i, unsigned int begin, unsigned int end) {
+    unsigned int j = begin;
+    switch (level) {
+#ifdef FILTER_SIMD_X86
+        case Level::AVX2:
+            j = SobelRowAVX2(source, gx, gy, width, i, begin, end);
+            break;
+        case Level::SSE41:
+            j = SobelRowSSE41(source, gx, gy, width, i, begin, end);
+            break;
+#endif
+        default:
+            break;
+    }
+    // Columns left over after the last full vector
+    const float* top = source + (i - 1) * width;
+    const float* middle = source + i * width;
+    const float* bottom = source + (i + 1) * width;
+    for (; j < end; j++) {
+        gx[i * width + j] = ((top[j + 1] - top[j - 1]) + 2.0f * (middle[j + 1] - middle[j - 1])) + (bottom[j + 1] - bottom[j - 1]);
+        gy[i * width + j] = ((top[j - 1] + 2.0f * top[j]) + top[j + 1]) - ((bottom[j - 1] + 2.0f * bottom[j]) + bottom[j + 1]);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef FILTERSIMD_H
+#define FILTERSIMD_H
+
+// Vectorized inner loops for Filter, picked at runtime from what the CPU supports.
+// Everything here works on interior pixels only; the caller handles the border with the scalar path.
+class FilterSimd {
+public:
+    enum class Level {
+        Scalar,
+        SSE41, // 4 pixels per iteration
+        AVX2   // 8 pixels per iteration
+    };
+
+    // Best instruction set available on this CPU, detected once
+    static Level SupportedLevel();
+
+    // Filters row i for columns [begin, end), where every tap must lie inside the image.
+    // weights holds the kernel in source order: weights[(2 * horizontal_radius + 1) * (l + vertical_radius) + (h + horizontal_radius)]
+    // multiplies the source pixel at (i + l, j + h).
+    // 3x3, 5x5 and 7x7 kernels run through instantiations with compile time loop bounds, other sizes use the runtime radii.
+    // Returns the first column it did not filter.
+    static unsigned int FilterRow(Level level, const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int i,
+                                  unsigned int begin, unsigned int end, const float* weights, int vertical_radius, int horizontal_radius, int offset);
+
+    // Luminance in [0, 1] of count RGBA pixels, (0.299 R + 0.587 G + 0.114 B) / 255
+    static void LuminanceRow(Level level, const unsigned char* source, float* dest, unsigned int count);
+
+    // Sobel derivatives of row i of a single channel image for columns [begin, end), where every 3x3 neighbourhood must lie inside the image.
+    // gx grows to the right and gy up the image, i.e. towards row i - 1.
+    static void SobelRow(Level level, const float* source, float* gx, float* gy, unsigned int width, unsigned int i, unsigned int begin, unsigned int end);
+};
+
+#endif // FILTERSIMD_H
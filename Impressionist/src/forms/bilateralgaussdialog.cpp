@@ -15,15 +15,25 @@ BilateralGaussDialog::BilateralGaussDialog(PaintView& paint_view, QWidget *paren
     preview_timer_.setInterval(1000);
     preview_timer_.setSingleShot(true);
     connect(&preview_timer_, &QTimer::timeout, this, &BilateralGaussDialog::Preview);
+    connect(&preview_renderer_, &PreviewRenderer::Ready, this, &BilateralGaussDialog::DrawPreview);
 
     // Connect all controls to trigger previewing
     connect(ui->sigma_domain_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this]() { preview_timer_.start(); });
     connect(ui->sigma_range_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this]() { preview_timer_.start(); });
+    connect(ui->grid_cell_size_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this]() { preview_timer_.start(); });
+    connect(ui->method_combobox, static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, [this]() {
+        // The cell size only applies to the grid
+        ui->grid_cell_size_spinbox->setEnabled(GetMode() == BilateralMode::Grid);
+        preview_timer_.start();
+    });
 
     // Preview Checkbox
     connect(ui->preview_checkbox, &QCheckBox::stateChanged, this, [this]() {
         if (ui->preview_checkbox->isChecked()) Preview();
-        else paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
+        else {
+            preview_renderer_.Cancel();
+            paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
+        }
     });
 
     // Dialog Button Box
@@ -32,8 +42,13 @@ BilateralGaussDialog::BilateralGaussDialog(PaintView& paint_view, QWidget *paren
             case QDialogButtonBox::ResetRole:
                 Reset();
                 break;
+            case QDialogButtonBox::AcceptRole:
+                FinishPreview();
+                break;
             case QDialogButtonBox::RejectRole:
                 // Draw the original image back to the paint view
+                preview_timer_.stop();
+                preview_renderer_.Cancel();
                 paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
                 break;
         }
@@ -48,27 +63,54 @@ int BilateralGaussDialog::exec() {
     paint_view_->SetCurrentLayer(PaintView::BASE_LAYER);
     // Save a copy of the original image
     original_image_ = paint_view_->GetSnapshot();
+    preview_renderer_.SetSource(original_image_);
     Preview();
-    return QDialog::exec();
+    int result = QDialog::exec();
+    // Holding on to the snapshot would make the layer copy it on the next change
+    preview_renderer_.SetSource(nullptr);
+    original_image_.reset();
+    return result;
 }
 
 void BilateralGaussDialog::Preview() {
     if (!ui->preview_checkbox->isChecked() || !original_image_) return;
 
-    // Allocate space for the filtered image
-    unsigned int width = paint_view_->GetWidth();
-    unsigned int height = paint_view_->GetHeight();
-    RGBABuffer filtered(width, height);
-
     // EXTRA CREDIT: Compute the filtered image
-    Filter::ApplyBilateralGaussianBlur(original_image_->Bytes, filtered.Bytes, width, height, ui->sigma_domain_spinbox->value(), ui->sigma_range_spinbox->value());
+    float sigma_space = ui->sigma_domain_spinbox->value();
+    float sigma_range = ui->sigma_range_spinbox->value();
+    BilateralMode mode = GetMode();
+    float grid_cell_size = ui->grid_cell_size_spinbox->value();
+    // Whatever is on screen gets refined first
+    preview_renderer_.SetRegion(paint_view_->GetVisibleRect());
+    preview_renderer_.Start([sigma_space, sigma_range, mode, grid_cell_size](const unsigned char* source, unsigned char* filtered, unsigned int width, unsigned int height, float scale) {
+        Filter::ApplyBilateralGaussianBlur(source, filtered, width, height, sigma_space / scale, sigma_range, mode, grid_cell_size);
+    }, Filter::BilateralGaussianHalo(sigma_space, mode, grid_cell_size));
+    // EXTRA CREDIT: Draw the filtered image (in DrawPreview, once it is ready)
+}
+
+void BilateralGaussDialog::DrawPreview() {
+    std::unique_ptr<RGBABuffer> filtered = preview_renderer_.TakeResult();
+    if (filtered) paint_view_->DrawImage(filtered->Bytes, filtered->Width, filtered->Height);
+}
+
+void BilateralGaussDialog::FinishPreview() {
+    if (!ui->preview_checkbox->isChecked() || !original_image_) return;
+    // Settings changed since the last preview started
+    if (preview_timer_.isActive()) {
+        preview_timer_.stop();
+        Preview();
+    }
+    preview_renderer_.Wait();
+    DrawPreview();
+}
 
-    // EXTRA CREDIT: Draw the filtered image
-    paint_view_->DrawImage(filtered.Bytes, width, height);
+BilateralMode BilateralGaussDialog::GetMode() {
+    return ui->method_combobox->currentIndex() == 1 ? BilateralMode::Grid : BilateralMode::Exact;
 }
 
 void BilateralGaussDialog::Reset() {
     ui->sigma_domain_spinbox->setValue(50);
     ui->sigma_range_spinbox->setValue(1);
+    ui->grid_cell_size_spinbox->setValue(1);
     Preview();
 }
@@ -2,6 +2,8 @@
 #define BILATERALGAUSSDIALOG_H
 
 #include <rgbabuffer.h>
+#include <previewrenderer.h>
+#include <filters/filter.h>
 #include <memory>
 #include <QDialog>
 #include <QTimer>
@@ -22,12 +24,22 @@ public:
 private:
     Ui::BilateralGaussDialog *ui;
     PaintView* paint_view_;
-    std::unique_ptr<RGBABuffer> original_image_;
+    std::shared_ptr<const RGBABuffer> original_image_;
     QTimer preview_timer_;
+    PreviewRenderer preview_renderer_;
 
-    // Applies the filter to the paint view
+    // Starts filtering the image in the background for the paint view
     void Preview();
 
+    // Draws the latest finished preview to the paint view
+    void DrawPreview();
+
+    // Waits for the preview of the current settings to finish at full size and draws it
+    void FinishPreview();
+
+    // Filter mode selected in the method combobox
+    BilateralMode GetMode();
+
     // Resets the UI controls to their default state
     void Reset();
 };
@@ -15,15 +15,20 @@ BilateralMeanDialog::BilateralMeanDialog(PaintView& paint_view, QWidget *parent)
     preview_timer_.setInterval(1000);
     preview_timer_.setSingleShot(true);
     connect(&preview_timer_, &QTimer::timeout, this, &BilateralMeanDialog::Preview);
+    connect(&preview_renderer_, &PreviewRenderer::Ready, this, &BilateralMeanDialog::DrawPreview);
 
     // Connect all controls to trigger previewing
     connect(ui->domain_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this]() { preview_timer_.start(); });
     connect(ui->range_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged), this, [this]() { preview_timer_.start(); });
+    connect(ui->method_combobox, static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged), this, [this]() { preview_timer_.start(); });
 
     // Preview Checkbox
     connect(ui->preview_checkbox, &QCheckBox::stateChanged, this, [this]() {
         if (ui->preview_checkbox->isChecked()) Preview();
-        else paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
+        else {
+            preview_renderer_.Cancel();
+            paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
+        }
     });
 
     // Dialog Button Box
@@ -32,8 +37,13 @@ BilateralMeanDialog::BilateralMeanDialog(PaintView& paint_view, QWidget *parent)
             case QDialogButtonBox::ResetRole:
                 Reset();
                 break;
+            case QDialogButtonBox::AcceptRole:
+                FinishPreview();
+                break;
             case QDialogButtonBox::RejectRole:
                 // Draw the original image back to the paint view
+                preview_timer_.stop();
+                preview_renderer_.Cancel();
                 paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
                 break;
         }
@@ -48,23 +58,48 @@ int BilateralMeanDialog::exec() {
     paint_view_->SetCurrentLayer(PaintView::BASE_LAYER);
     // Save a copy of the original image
     original_image_ = paint_view_->GetSnapshot();
+    preview_renderer_.SetSource(original_image_);
     Preview();
-    return QDialog::exec();
+    int result = QDialog::exec();
+    // Holding on to the snapshot would make the layer copy it on the next change
+    preview_renderer_.SetSource(nullptr);
+    original_image_.reset();
+    return result;
 }
 
 void BilateralMeanDialog::Preview() {
     if (!ui->preview_checkbox->isChecked() || !original_image_) return;
 
-    // Allocate space for the filtered image
-    unsigned int width = paint_view_->GetWidth();
-    unsigned int height = paint_view_->GetHeight();
-    RGBABuffer filtered(width, height);
-
     // REQUIREMENT: Compute the filtered image
-    Filter::ApplyBilateralMeanBlur(original_image_->Bytes, filtered.Bytes, width, height, ui->domain_spinbox->value(), ui->range_spinbox->value());
+    unsigned int domain_half_width = ui->domain_spinbox->value();
+    unsigned int range = ui->range_spinbox->value();
+    BilateralMeanMode mode = GetMode();
+    // Whatever is on screen gets refined first
+    preview_renderer_.SetRegion(paint_view_->GetVisibleRect());
+    preview_renderer_.Start([domain_half_width, range, mode](const unsigned char* source, unsigned char* filtered, unsigned int width, unsigned int height, float scale) {
+        Filter::ApplyBilateralMeanBlur(source, filtered, width, height, (unsigned int)(domain_half_width / scale), range, mode);
+    }, Filter::BilateralMeanHalo(domain_half_width));
+    // REQUIREMENT: Draw the filtered image (in DrawPreview, once it is ready)
+}
+
+void BilateralMeanDialog::DrawPreview() {
+    std::unique_ptr<RGBABuffer> filtered = preview_renderer_.TakeResult();
+    if (filtered) paint_view_->DrawImage(filtered->Bytes, filtered->Width, filtered->Height);
+}
+
+void BilateralMeanDialog::FinishPreview() {
+    if (!ui->preview_checkbox->isChecked() || !original_image_) return;
+    // Settings changed since the last preview started
+    if (preview_timer_.isActive()) {
+        preview_timer_.stop();
+        Preview();
+    }
+    preview_renderer_.Wait();
+    DrawPreview();
+}
 
-    // REQUIREMENT: Draw the filtered image
-    paint_view_->DrawImage(filtered.Bytes, width, height);
+BilateralMeanMode BilateralMeanDialog::GetMode() {
+    return ui->method_combobox->currentIndex() == 1 ? BilateralMeanMode::Histogram : BilateralMeanMode::Exact;
 }
 
 void BilateralMeanDialog::Reset() {
@@ -1,13 +1,5 @@
 #include "brushdialog.h"
 #include "ui_brushdialog.h"
-#include <brushes/pointbrush.h>
-#include <brushes/uwbrush.h>
-#include <brushes/linebrush.h>
-#include <brushes/scatterlinebrush.h>
-#include <brushes/scatterpointbrush.h>
-#include <brushes/circlebrush.h>
-#include <brushes/scattercirclebrush.h>
-#include <brushes/star.h>
 
 BrushDialog::BrushDialog(QWidget *parent) :
     QDialog(parent),
@@ -18,15 +10,10 @@ BrushDialog::BrushDialog(QWidget *parent) :
     ui->setupUi(this);
 
     // Create the brushes
-    brushes_[Brushes::Point] = std::make_unique<PointBrush>("Points");
-    // REQUIREMENT: Implement these five brushes. They are set to all be the same for now.
-    brushes_[Brushes::Line] = std::make_unique<LineBrush>("Lines");
-    brushes_[Brushes::Circle] = std::make_unique<CircleBrush>("Circles");
-    brushes_[Brushes::ScatterPoint] = std::make_unique<ScatterPointBrush>("Scattered Points");
-    brushes_[Brushes::ScatterLine] = std::make_unique<ScatterLineBrush>("Scattered Lines");
-    brushes_[Brushes::ScatterCircle] = std::make_unique<ScatterCircleBrush>("Scattered Circles");
-    brushes_[Brushes::UW] = std::make_unique<UWBrush>("UW");
-    brushes_[Brushes::Star] = std::make_unique<StarBrush>("Star");
+    for (Brushes type : { Brushes::Point, Brushes::Line, Brushes::Circle, Brushes::ScatterPoint,
+                          Brushes::ScatterLine, Brushes::ScatterCircle, Brushes::UW, Brushes::Star }) {
+        brushes_[type] = Brush::Create(type);
+    }
 
     // Add the brushes to the combo box
     for (auto& kv : brushes_) {
@@ -71,3 +58,9 @@ AngleMode BrushDialog::GetCurrentAngleControl() {
     return angle_choices_[current_angle_choice_];
 
 }
+
+void BrushDialog::SetColorImage(std::shared_ptr<const ReferenceImage> color_image) {
+    for (auto& kv : brushes_) {
+        kv.second->SetColorImage(color_image);
+    }
+}
@@ -20,6 +20,9 @@ public:
     Brush& GetCurrentBrush();
     AngleMode GetCurrentAngleControl();
 
+    // Gives every brush the image to sample colors from, once per loaded reference
+    void SetColorImage(std::shared_ptr<const ReferenceImage> color_image);
+
 private:
     Ui::BrushDialog *ui;
     std::map<Brushes, std::unique_ptr<Brush>> brushes_;
@@ -17,6 +17,7 @@ FilterKernelDialog::FilterKernelDialog(PaintView& paint_view, QWidget *parent) :
     preview_timer_.setInterval(500);
     preview_timer_.setSingleShot(true);
     connect(&preview_timer_, &QTimer::timeout, this, &FilterKernelDialog::Preview);
+    connect(&preview_renderer_, &PreviewRenderer::Ready, this, &FilterKernelDialog::DrawPreview);
 
     // Connect all controls to trigger previewing
     for (unsigned int j = 0; j < KERNEL_HEIGHT; j++) {
@@ -33,7 +34,10 @@ FilterKernelDialog::FilterKernelDialog(PaintView& paint_view, QWidget *parent) :
     // Preview Checkbox
     connect(ui->preview_checkbox, &QCheckBox::stateChanged, this, [this]() {
         if (ui->preview_checkbox->isChecked()) Preview();
-        else paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
+        else {
+            preview_renderer_.Cancel();
+            paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
+        }
     });
 
     // Dialog Button Box
@@ -42,8 +46,13 @@ FilterKernelDialog::FilterKernelDialog(PaintView& paint_view, QWidget *parent) :
             case QDialogButtonBox::ResetRole:
                 Reset();
                 break;
+            case QDialogButtonBox::AcceptRole:
+                FinishPreview();
+                break;
             case QDialogButtonBox::RejectRole:
                 // Draw the original image back to the paint view
+                preview_timer_.stop();
+                preview_renderer_.Cancel();
                 paint_view_->DrawImage(original_image_->Bytes, original_image_->Width, original_image_->Height);
                 break;
         }
@@ -58,7 +67,12 @@ int FilterKernelDialog::exec() {
     paint_view_->SetCurrentLayer(PaintView::BASE_LAYER);
     // Save a copy of the original image
     original_image_ = paint_view_->GetSnapshot();
-    return QDialog::exec();
+    preview_renderer_.SetSource(original_image_);
+    int result = QDialog::exec();
+    // Holding on to the snapshot would make the layer copy it on the next change
+    preview_renderer_.SetSource(nullptr);
+    original_image_.reset();
+    return result;
 }
 
 float FilterKernelDialog::GetKernelValue(int i, int j) {
@@ -70,11 +84,6 @@ float FilterKernelDialog::GetKernelValue(int i, int j) {
 void FilterKernelDialog::Preview() {
     if (!ui->preview_checkbox->isChecked() || !original_image_) return;
 
-    // Allocate space for the filtered image
-    unsigned int width = paint_view_->GetWidth();
-    unsigned int height = paint_view_->GetHeight();
-    RGBABuffer filtered(width, height);
-
     // REQUIREMENT: Compute the filtered image
     // See FilterKernelDialog::GetKernelValue to access kernel values from UI
     // Filter::ApplyFilterKernel(...);
@@ -85,11 +94,11 @@ void FilterKernelDialog::Preview() {
     if (divisor - 0 < epsilon) divisor = 1.0;
     float total = 0.0;
 
-    Kernel* kernel = new Kernel(KERNEL_HEIGHT, KERNEL_WIDTH);
+    Kernel kernel(KERNEL_HEIGHT, KERNEL_WIDTH);
     for (unsigned int i = 0; i < KERNEL_HEIGHT; i++) {
         for (unsigned int j = 0; j < KERNEL_WIDTH; j++) {
-            kernel->matrix[i][j] = GetKernelValue(j,i) / divisor;
-            total += kernel->matrix[i][j];
+            kernel(i, j) = GetKernelValue(j,i) / divisor;
+            total += kernel(i, j);
         }
     }
 
@@ -97,15 +106,35 @@ void FilterKernelDialog::Preview() {
         if (total - 0 > epsilon) {
             for (unsigned int i = 0; i < KERNEL_HEIGHT; i++) {
                 for (unsigned int j = 0; j < KERNEL_WIDTH; j++) {
-                    kernel->matrix[i][j] /= total;
+                    kernel(i, j) /= total;
                 }
             }
         }
     }
 
-    Filter::ApplyFilterKernel(original_image_->Bytes, filtered.Bytes, width, height, *kernel, offset, true);
-    // REQUIREMENT: Draw the filtered image
-    paint_view_->DrawImage(filtered.Bytes, width, height);
+    // The kernel is in pixels, so the reduced pass just filters more of the image per tap
+    // Whatever is on screen gets refined first
+    preview_renderer_.SetRegion(paint_view_->GetVisibleRect());
+    preview_renderer_.Start([kernel, offset](const unsigned char* source, unsigned char* filtered, unsigned int width, unsigned int height, float) mutable {
+        Filter::ApplyFilterKernel(source, filtered, width, height, kernel, offset, true);
+    }, Filter::FilterKernelHalo(kernel));
+    // REQUIREMENT: Draw the filtered image (in DrawPreview, once it is ready)
+}
+
+void FilterKernelDialog::DrawPreview() {
+    std::unique_ptr<RGBABuffer> filtered = preview_renderer_.TakeResult();
+    if (filtered) paint_view_->DrawImage(filtered->Bytes, filtered->Width, filtered->Height);
+}
+
+void FilterKernelDialog::FinishPreview() {
+    if (!ui->preview_checkbox->isChecked() || !original_image_) return;
+    // Settings changed since the last preview started
+    if (preview_timer_.isActive()) {
+        preview_timer_.stop();
+        Preview();
+    }
+    preview_renderer_.Wait();
+    DrawPreview();
 }
 
 void FilterKernelDialog::Reset() {
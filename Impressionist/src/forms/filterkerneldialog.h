@@ -2,6 +2,7 @@
 #define FILTERKERNELDIALOG_H
 
 #include <rgbabuffer.h>
+#include <previewrenderer.h>
 #include <memory>
 #include <QDialog>
 #include <QTimer>
@@ -24,12 +25,19 @@ private:
     const unsigned int KERNEL_HEIGHT = 5;
     Ui::FilterKernelDialog *ui;
     PaintView* paint_view_;
-    std::unique_ptr<RGBABuffer> original_image_;
+    std::shared_ptr<const RGBABuffer> original_image_;
     QTimer preview_timer_;
+    PreviewRenderer preview_renderer_;
 
-    // Applies the filter kernel to the paint view
+    // Starts filtering the image in the background for the paint view
     void Preview();
 
+    // Draws the latest finished preview to the paint view
+    void DrawPreview();
+
+    // Waits for the preview of the current settings to finish at full size and draws it
+    void FinishPreview();
+
     // Returns the value of the spinbox in matrix column i, row j
     float GetKernelValue(int i, int j);
 
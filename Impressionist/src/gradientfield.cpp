@@ -0,0 +1,94 @@
+#include "gradientfield.h"
+#include <threadpool.h>
+#include <rgbabuffer.h>
+#include <filters/filter.h>
+#include <filters/filtersimd.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+GradientField::GradientField() :
+    width_(0),
+    height_(0)
+{
+
+}
+
+void GradientField::Compute(const unsigned char* image, unsigned int width, unsigned int height, float smoothing) {
+    width_ = width;
+    height_ = height;
+    gx_.assign(width * height, 0.0f);
+    gy_.assign(width * height, 0.0f);
+    if (width == 0 || height == 0) return;
+
+    // Blurring the colors blurs the luminance the same way, and goes through the optimized filters
+    std::unique_ptr<RGBABuffer> smoothed;
+    if (smoothing > 0.0f) {
+        smoothed.reset(new RGBABuffer(width, height));
+        Filter::ApplyGaussianBlur(image, smoothed->Bytes, width, height, smoothing, smoothing >= 5.0f ? BlurMode::Box : BlurMode::Exact);
+        image = smoothed->Bytes;
+    }
+
+    FilterSimd::Level level = FilterSimd::SupportedLevel();
+    std::vector<float, AlignedAllocator<float>> luminance(width * height);
+    ThreadPool::Instance().ParallelFor(height, 16, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            FilterSimd::LuminanceRow(level, image + 4 * i * width, luminance.data() + i * width, width);
+        }
+    });
+
+    ThreadPool::Instance().ParallelFor(height, 16, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            if (i == 0 || i == height - 1 || width < 3) {
+                for (unsigned int j = 0; j < width; j++) ComputeBorderPixel(luminance.data(), i, j);
+                continue;
+            }
+            ComputeBorderPixel(luminance.data(), i, 0);
+            FilterSimd::SobelRow(level, luminance.data(), gx_.data(), gy_.data(), width, i, 1, width - 1);
+            ComputeBorderPixel(luminance.data(), i, width - 1);
+        }
+    });
+}
+
+void GradientField::Clear() {
+    width_ = 0;
+    height_ = 0;
+    gx_.clear();
+    gy_.clear();
+}
+
+bool GradientField::IsEmpty() const {
+    return gx_.empty();
+}
+
+glm::vec2 GradientField::GetGradient(glm::vec2 pos) const {
+    if (IsEmpty()) return glm::vec2(0.0f, 0.0f);
+    int x = std::min(std::max((int)pos.x, 0), (int)width_ - 1);
+    int y = std::min(std::max((int)pos.y, 0), (int)height_ - 1);
+    return glm::vec2(gx_[y * width_ + x], gy_[y * width_ + x]);
+}
+
+float GradientField::GetMagnitude(glm::vec2 pos) const {
+    return glm::length(GetGradient(pos));
+}
+
+unsigned int GradientField::GetAngle(glm::vec2 pos) const {
+    glm::vec2 gradient = GetGradient(pos);
+    // 90 degrees to the gradient angle
+    float angle = 90.0f - std::atan2(gradient.y, gradient.x) * 180.0f / M_PI;
+    while (angle < 0.0f) angle += 360.0f;
+    return (unsigned int)angle % 360;
+}
+
+void GradientField::ComputeBorderPixel(const float* luminance, unsigned int i, unsigned int j) {
+    auto at = [&](int row, int column) {
+        row = std::min(std::max(row, 0), (int)height_ - 1);
+        column = std::min(std::max(column, 0), (int)width_ - 1);
+        return luminance[row * width_ + column];
+    };
+    // Same sums as FilterSimd::SobelRow
+    int y = i;
+    int x = j;
+    gx_[i * width_ + j] = ((at(y - 1, x + 1) - at(y - 1, x - 1)) + 2.0f * (at(y, x + 1) - at(y, x - 1))) + (at(y + 1, x + 1) - at(y + 1, x - 1));
+    gy_[i * width_ + j] = ((at(y - 1, x - 1) + 2.0f * at(y - 1, x)) + at(y - 1, x + 1)) - ((at(y + 1, x - 1) + 2.0f * at(y + 1, x)) + at(y + 1, x + 1));
+}
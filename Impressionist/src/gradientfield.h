@@ -0,0 +1,40 @@
+#ifndef GRADIENTFIELD_H
+#define GRADIENTFIELD_H
+
+#include <vectors.h>
+#include <alignedallocator.h>
+#include <vector>
+
+// Sobel gradient of an image's luminance, computed once so strokes can look up their direction at every dab.
+// x grows to the right and y up the image, the convention the gradient angle mode has always used.
+class GradientField {
+public:
+    GradientField();
+
+    // Computes the field of a width x height RGBA image, rows top first. With smoothing above 0 the image is first blurred
+    // by a gaussian of that sigma, which keeps stroke directions from following noise.
+    void Compute(const unsigned char* image, unsigned int width, unsigned int height, float smoothing = 0.0f);
+
+    // Drops the field, e.g. while no image is loaded
+    void Clear();
+
+    bool IsEmpty() const;
+
+    // Gradient of the luminance, in [0, 1] per pixel, at the pixel containing pos. Positions outside the image use the nearest pixel.
+    glm::vec2 GetGradient(glm::vec2 pos) const;
+    float GetMagnitude(glm::vec2 pos) const;
+
+    // Brush angle in degrees running across the gradient at pos, along the edges of the image
+    unsigned int GetAngle(glm::vec2 pos) const;
+
+private:
+    // Gradient at row i, column j, reading the luminance with coordinates clamped to the image
+    void ComputeBorderPixel(const float* luminance, unsigned int i, unsigned int j);
+
+    unsigned int width_;
+    unsigned int height_;
+    std::vector<float, AlignedAllocator<float>> gx_;
+    std::vector<float, AlignedAllocator<float>> gy_;
+};
+
+#endif // GRADIENTFIELD_H
@@ -0,0 +1,73 @@
+#include "imageloader.h"
+#include <threadpool.h>
+#include <climits>
+#include <QDir>
+#include <QImageReader>
+#include <QTemporaryFile>
+
+std::shared_ptr<RGBABuffer> ImageLoader::Load(const QString& filename) {
+    QImageReader reader(filename);
+    // Both only read the file's header
+    QSize size = reader.size();
+    QImage::Format format = reader.imageFormat();
+
+    std::shared_ptr<RGBABuffer> buffer;
+    QImage decoded;
+    if (size.isValid() && format != QImage::Format_Invalid && QImage::toPixelFormat(format).bitsPerPixel() == 32) {
+        buffer = Allocate(size.width(), size.height());
+        if (!buffer) return nullptr;
+        // The image handlers decode into the image they are given when it has the size and format they would pick
+        decoded = QImage(buffer->Bytes, size.width(), size.height(), format);
+    }
+    if (!reader.read(&decoded)) return nullptr;
+
+    unsigned int width = decoded.width();
+    unsigned int height = decoded.height();
+    unsigned int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+    if (buffer && decoded.constBits() == buffer->Bytes) {
+        if (decoded.format() == QImage::Format_RGBA8888) return buffer;
+        // Same pixel size, so each band is converted over itself
+        ThreadPool::Instance().ParallelFor(bands, 1, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int band = begin; band < end; band++) {
+                unsigned int top = band * BAND_ROWS;
+                unsigned int rows = height - top < BAND_ROWS ? height - top : BAND_ROWS;
+                unsigned char* pixels = buffer->Bytes + 4 * top * width;
+                QImage converted = QImage(pixels, width, rows, decoded.format()).convertToFormat(QImage::Format_RGBA8888);
+                memcpy(pixels, converted.constBits(), 4 * rows * width);
+            }
+        });
+        return buffer;
+    }
+
+    // The handler made an image of its own, e.g. for formats of fewer bits, which is converted into the buffer a band at a time
+    if (!buffer || buffer->Width != width || buffer->Height != height) {
+        buffer = Allocate(width, height);
+        if (!buffer) return nullptr;
+    }
+    ThreadPool::Instance().ParallelFor(bands, 1, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int band = begin; band < end; band++) {
+            unsigned int top = band * BAND_ROWS;
+            unsigned int rows = height - top < BAND_ROWS ? height - top : BAND_ROWS;
+            QImage converted = decoded.copy(0, top, width, rows).convertToFormat(QImage::Format_RGBA8888);
+            // RGBA rows are never padded
+            memcpy(buffer->Bytes + 4 * top * width, converted.constBits(), 4 * rows * width);
+        }
+    });
+    return buffer;
+}
+
+std::shared_ptr<RGBABuffer> ImageLoader::Allocate(unsigned int width, unsigned int height) {
+    // RGBABuffer counts its bytes in an unsigned int
+    unsigned long long size = 4ull * width * height;
+    if (size > UINT_MAX) return nullptr;
+
+    if (size >= MAP_THRESHOLD) {
+        std::shared_ptr<QTemporaryFile> file = std::make_shared<QTemporaryFile>(QDir::temp().filePath("impressionist-image-XXXXXX"));
+        unsigned char* bytes = nullptr;
+        if (file->open() && file->resize(size)) bytes = file->map(0, size);
+        // The file is removed once the buffer lets go of it
+        if (bytes) return std::make_shared<RGBABuffer>(width, height, bytes, [file, bytes]() { file->unmap(bytes); });
+    }
+    // Falls back to the heap if the file couldn't be mapped
+    return std::make_shared<RGBABuffer>(width, height);
+}
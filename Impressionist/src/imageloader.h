@@ -0,0 +1,30 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <rgbabuffer.h>
+#include <cstddef>
+#include <memory>
+#include <QString>
+
+// Decodes image files into RGBA32 buffers, rows counting from the top like QImage's.
+// The decoder writes straight into the returned buffer, which is then converted to RGBA in place a band of rows at a time,
+// so loading takes little more memory than the image itself instead of a decoded, a converted and a copied image.
+// Large images are kept in a mapped temporary file rather than on the heap, so the system can page out
+// the parts nobody samples and read them back in on demand.
+class ImageLoader {
+public:
+    // Images of at least this many bytes are mapped from a temporary file
+    static const size_t MAP_THRESHOLD = 256 << 20;
+
+    // nullptr if the file can't be decoded or the image is too large for an RGBABuffer
+    static std::shared_ptr<RGBABuffer> Load(const QString& filename);
+
+private:
+    // Rows converted at a time, each band taking a small temporary image
+    static const unsigned int BAND_ROWS = 64;
+
+    // Buffer for width x height pixels, mapped from a temporary file if it is large
+    static std::shared_ptr<RGBABuffer> Allocate(unsigned int width, unsigned int height);
+};
+
+#endif // IMAGELOADER_H
@@ -1,7 +1,375 @@
 #include "layer.h"
+#include <algorithm>
+#include <cstring>
 
 Layer::Layer(unsigned int width, unsigned int height) :
-    framebuffer_(QSize(width, height))
+    width_(width),
+    height_(height),
+    contents_(width, height),
+    gpu_tiles_(contents_.GetColumns() * contents_.GetRows()),
+    resident_tiles_(0),
+    use_clock_(0),
+    cell_columns_((width + CELL_SIZE - 1) / CELL_SIZE),
+    cell_rows_((height + CELL_SIZE - 1) / CELL_SIZE),
+    dirty_cells_(cell_columns_ * cell_rows_, 0),
+    pending_cells_(cell_columns_ * cell_rows_, 0)
 {
 
 }
+
+Layer::~Layer() {
+    CompleteReadbacks(true);
+}
+
+void Layer::MarkDirtyAround(const glm::vec2& pos, float reach) {
+    // A couple of extra pixels cover antialiasing and rounding
+    int extent = (int)std::ceil(reach) + 2;
+    int x = (int)std::floor(pos.x);
+    int y = height_ - 1 - (int)std::floor(pos.y);
+    MarkCells(pending_cells_, QRect(x - extent, y - extent, 2 * extent + 1, 2 * extent + 1));
+}
+
+void Layer::DrawStrokes(StrokeBatch& batch) {
+    batch.DrawTiled(TILE_SIZE, contents_.GetColumns(), contents_.GetRows(), height_, [this](unsigned int column, unsigned int row) {
+        MakeResident(column, row).bind();
+        glViewport(0, 0, TILE_SIZE, TILE_SIZE);
+
+        // The tile's strokes are newer than the CPU copy from here on, also if it is evicted before the batch is done
+        for (unsigned int y = row * CELLS_PER_TILE; y < std::min(cell_rows_, (row + 1) * CELLS_PER_TILE); y++) {
+            for (unsigned int x = column * CELLS_PER_TILE; x < std::min(cell_columns_, (column + 1) * CELLS_PER_TILE); x++) {
+                if (pending_cells_[y * cell_columns_ + x]) dirty_cells_[y * cell_columns_ + x] = 1;
+                pending_cells_[y * cell_columns_ + x] = 0;
+            }
+        }
+
+        glm::vec2 origin = TileOrigin(column, row);
+        return glm::ortho(origin.x, origin.x + TILE_SIZE, origin.y, origin.y + TILE_SIZE);
+    });
+    // Whatever is left was reached by no dab
+    std::fill(pending_cells_.begin(), pending_cells_.end(), 0);
+    TileCache::Instance().Trim();
+}
+
+void Layer::RasterizeStrokes(StrokeBatch& batch) {
+    // Brings the CPU copy up to date, it is what the strokes are drawn on
+    ReadBackDirty();
+    QRect changed = batch.Rasterize(contents_, true);
+
+    QRect tiles = TilesAround(changed);
+    for (int row = tiles.top(); row <= tiles.bottom(); row++) {
+        for (int column = tiles.left(); column <= tiles.right(); column++) {
+            if (!gpu_tiles_[row * contents_.GetColumns() + column].framebuffer) continue;
+            UploadTile(column, row, changed.intersected(QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE)));
+        }
+    }
+    TileCache::Instance().Trim();
+}
+
+void Layer::DrawTiles(const QRect& area, const std::function<void(const glm::mat4& tile_transform)>& draw) {
+    QRect tiles = TilesAround(area);
+    for (int row = tiles.top(); row <= tiles.bottom(); row++) {
+        for (int column = tiles.left(); column <= tiles.right(); column++) {
+            MakeResident(column, row).bind();
+            glViewport(0, 0, TILE_SIZE, TILE_SIZE);
+            MarkCells(dirty_cells_, area.intersected(QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE)));
+
+            // Scales the layer's clip coordinates up to the tile's, then moves the tile's origin to -1, -1
+            glm::vec2 origin = TileOrigin(column, row);
+            glm::vec2 scale = glm::vec2(width_, height_) / float(TILE_SIZE);
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(scale - 2.0f * origin / float(TILE_SIZE) - 1.0f, 0.0f));
+            draw(glm::scale(transform, glm::vec3(scale, 1.0f)));
+        }
+    }
+    TileCache::Instance().Trim();
+}
+
+void Layer::PrepareTextures(const QRect& area) {
+    QRect tiles = TilesAround(area);
+    for (int row = tiles.top(); row <= tiles.bottom(); row++) {
+        for (int column = tiles.left(); column <= tiles.right(); column++) {
+            unsigned char color[4];
+            // Nothing to show
+            if (!gpu_tiles_[row * contents_.GetColumns() + column].framebuffer && contents_.IsUniform(column, row, color) && color[3] == 0) continue;
+            MakeResident(column, row);
+        }
+    }
+    TileCache::Instance().Trim();
+}
+
+void Layer::ForEachTexture(const QRect& area, const std::function<void(GLuint texture, const glm::vec2& origin)>& draw) const {
+    QRect tiles = TilesAround(area);
+    for (int row = tiles.top(); row <= tiles.bottom(); row++) {
+        for (int column = tiles.left(); column <= tiles.right(); column++) {
+            const GpuTile& tile = gpu_tiles_[row * contents_.GetColumns() + column];
+            if (tile.framebuffer) draw(tile.framebuffer->texture(), TileOrigin(column, row));
+        }
+    }
+}
+
+void Layer::SetContents(const unsigned char* image, bool flipped) {
+    // Queued readbacks hold older pixels and would overwrite these
+    CompleteReadbacks(true);
+    std::fill(dirty_cells_.begin(), dirty_cells_.end(), 0);
+    std::fill(pending_cells_.begin(), pending_cells_.end(), 0);
+
+    ptrdiff_t row_size = 4 * (ptrdiff_t)width_;
+    // A row of tiles at a time, so no more of them than the cache allows are in memory at once
+    for (unsigned int row = 0; row < contents_.GetRows(); row++) {
+        QRect band(0, row * TILE_SIZE, width_, height_ - row * TILE_SIZE < TILE_SIZE ? height_ - row * TILE_SIZE : TILE_SIZE);
+        if (flipped) contents_.Write(band, image + (height_ - 1 - band.y()) * row_size, -row_size);
+        else contents_.Write(band, image + band.y() * row_size, row_size);
+
+        for (unsigned int column = 0; column < contents_.GetColumns(); column++) {
+            contents_.Compact(column, row);
+            // Tiles on the GPU stay there, e.g. for previews replacing the image over and over
+            GpuTile& tile = gpu_tiles_[row * contents_.GetColumns() + column];
+            if (!tile.framebuffer) continue;
+            unsigned char color[4];
+            if (contents_.IsUniform(column, row, color)) {
+                tile.framebuffer->bind();
+                glClearColor(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f, color[3] / 255.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+            } else {
+                UploadTile(column, row, QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE));
+            }
+        }
+        TileCache::Instance().Trim();
+    }
+}
+
+void Layer::SetContents(const glm::vec4& color) {
+    CompleteReadbacks(true);
+    std::fill(dirty_cells_.begin(), dirty_cells_.end(), 0);
+    std::fill(pending_cells_.begin(), pending_cells_.end(), 0);
+
+    // Same rounding as the framebuffer's conversion to 8 bits
+    unsigned char pixel[4];
+    for (unsigned int p = 0; p < 4; p++) {
+        pixel[p] = (unsigned char)(glm::clamp(color[p], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+    contents_.Fill(pixel);
+
+    // Tiles get a framebuffer again once they are drawn on or shown
+    for (GpuTile& tile : gpu_tiles_) tile.framebuffer.reset();
+    resident_tiles_ = 0;
+}
+
+std::shared_ptr<const RGBABuffer> Layer::Snapshot() {
+    ReadBackDirty();
+    return contents_.ToBuffer();
+}
+
+std::shared_future<std::shared_ptr<const RGBABuffer>> Layer::SnapshotAsync() {
+    std::vector<QRect> runs;
+    for (unsigned int row = 0; row < contents_.GetRows(); row++) {
+        for (unsigned int column = 0; column < contents_.GetColumns(); column++) {
+            std::vector<QRect> tile_runs = TakeDirtyRuns(column, row);
+            // Tiles without a framebuffer are up to date on the CPU
+            if (gpu_tiles_[row * contents_.GetColumns() + column].framebuffer) runs.insert(runs.end(), tile_runs.begin(), tile_runs.end());
+        }
+    }
+
+    if (runs.empty()) {
+        // Nothing changed since the last readback was queued, so it will have the same pixels
+        if (!readbacks_.empty()) return readbacks_.back()->result;
+        std::promise<std::shared_ptr<const RGBABuffer>> done;
+        done.set_value(contents_.ToBuffer());
+        return done.get_future().share();
+    }
+
+    std::unique_ptr<Readback> readback(new Readback());
+    readback->runs = runs;
+    readback->result = readback->promise.get_future().share();
+    size_t size = 0;
+    for (const QRect& run : readback->runs) size += 4 * run.width() * run.height();
+
+    // glReadPixels into a bound pixel pack buffer returns without waiting for the GPU
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glGenBuffers(1, &readback->buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    size_t offset = 0;
+    for (const QRect& run : readback->runs) {
+        ReadRun(run, (void*)offset);
+        offset += 4 * run.width() * run.height();
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Make sure the fence reaches the GPU, otherwise polling it could wait forever
+    glFlush();
+
+    std::shared_future<std::shared_ptr<const RGBABuffer>> result = readback->result;
+    readbacks_.push_back(std::move(readback));
+    return result;
+}
+
+bool Layer::CompleteReadbacks(bool wait) {
+    while (!readbacks_.empty()) {
+        Readback& readback = *readbacks_.front();
+        GLenum status;
+        do {
+            status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+        } while (wait && status == GL_TIMEOUT_EXPIRED);
+        if (status == GL_TIMEOUT_EXPIRED) return true;
+        glDeleteSync(readback.fence);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        size_t size = 0;
+        for (const QRect& run : readback.runs) size += 4 * run.width() * run.height();
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        for (const QRect& run : readback.runs) {
+            CopyRun(run, pixels);
+            pixels += 4 * run.width() * run.height();
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glDeleteBuffers(1, &readback.buffer);
+
+        readback.promise.set_value(contents_.ToBuffer());
+        readbacks_.pop_front();
+    }
+    return false;
+}
+
+void Layer::MarkCells(std::vector<char>& cells, const QRect& rect) {
+    QRect clipped = rect.intersected(QRect(0, 0, width_, height_));
+    if (clipped.isEmpty()) return;
+    for (unsigned int row = clipped.top() / CELL_SIZE; row <= clipped.bottom() / CELL_SIZE; row++) {
+        for (unsigned int column = clipped.left() / CELL_SIZE; column <= clipped.right() / CELL_SIZE; column++) {
+            cells[row * cell_columns_ + column] = 1;
+        }
+    }
+}
+
+QOpenGLFramebufferObject& Layer::MakeResident(unsigned int column, unsigned int row) {
+    GpuTile& tile = gpu_tiles_[row * contents_.GetColumns() + column];
+    tile.last_used = ++use_clock_;
+    if (tile.framebuffer) return *tile.framebuffer;
+
+    if (resident_tiles_ >= GPU_TILE_BUDGET) {
+        // This tile has no framebuffer yet, so it is never the one picked
+        size_t oldest = gpu_tiles_.size();
+        for (size_t k = 0; k < gpu_tiles_.size(); k++) {
+            if (!gpu_tiles_[k].framebuffer) continue;
+            if (oldest == gpu_tiles_.size() || gpu_tiles_[k].last_used < gpu_tiles_[oldest].last_used) oldest = k;
+        }
+        Evict(oldest % contents_.GetColumns(), oldest / contents_.GetColumns());
+    }
+
+    tile.framebuffer.reset(new QOpenGLFramebufferObject(QSize(TILE_SIZE, TILE_SIZE)));
+    resident_tiles_++;
+    unsigned char color[4];
+    if (contents_.IsUniform(column, row, color)) {
+        tile.framebuffer->bind();
+        glClearColor(color[0] / 255.0f, color[1] / 255.0f, color[2] / 255.0f, color[3] / 255.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    } else {
+        UploadTile(column, row, QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE));
+    }
+    return *tile.framebuffer;
+}
+
+void Layer::Evict(unsigned int column, unsigned int row) {
+    std::vector<QRect> runs = TakeDirtyRuns(column, row);
+    if (!runs.empty()) {
+        // Queued readbacks hold older pixels, so they must land first
+        CompleteReadbacks(true);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        std::vector<unsigned char> pixels;
+        for (const QRect& run : runs) {
+            pixels.resize(4 * run.width() * run.height());
+            ReadRun(run, pixels.data());
+            CopyRun(run, pixels.data());
+        }
+    }
+    gpu_tiles_[row * contents_.GetColumns() + column].framebuffer.reset();
+    resident_tiles_--;
+}
+
+void Layer::UploadTile(unsigned int column, unsigned int row, const QRect& area) {
+    QRect clipped = area.intersected(QRect(0, 0, width_, height_));
+    if (clipped.isEmpty()) return;
+
+    ptrdiff_t row_size = 4 * clipped.width();
+    upload_pixels_.resize(row_size * clipped.height());
+    contents_.Read(clipped, upload_pixels_.data() + (clipped.height() - 1) * row_size, -row_size);
+    glBindTexture(GL_TEXTURE_2D, gpu_tiles_[row * contents_.GetColumns() + column].framebuffer->texture());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, clipped.x() - column * TILE_SIZE, (row + 1) * TILE_SIZE - 1 - clipped.bottom(),
+                    clipped.width(), clipped.height(), GL_RGBA, GL_UNSIGNED_BYTE, upload_pixels_.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+glm::vec2 Layer::TileOrigin(unsigned int column, unsigned int row) const {
+    return glm::vec2(column * TILE_SIZE, (int)height_ - (int)((row + 1) * TILE_SIZE));
+}
+
+QRect Layer::TilesAround(const QRect& area) const {
+    QRect clipped = area.intersected(QRect(0, 0, width_, height_));
+    if (clipped.isEmpty()) return QRect();
+    int left = clipped.left() / TILE_SIZE;
+    int top = clipped.top() / TILE_SIZE;
+    return QRect(left, top, clipped.right() / TILE_SIZE - left + 1, clipped.bottom() / TILE_SIZE - top + 1);
+}
+
+void Layer::ReadBackDirty() {
+    // Queued readbacks hold older pixels, so they must land first
+    CompleteReadbacks(true);
+    if (std::find(dirty_cells_.begin(), dirty_cells_.end(), 1) == dirty_cells_.end()) return;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    std::vector<unsigned char> pixels;
+    for (unsigned int row = 0; row < contents_.GetRows(); row++) {
+        for (unsigned int column = 0; column < contents_.GetColumns(); column++) {
+            std::vector<QRect> runs = TakeDirtyRuns(column, row);
+            // Tiles without a framebuffer are up to date on the CPU
+            if (!gpu_tiles_[row * contents_.GetColumns() + column].framebuffer) continue;
+            for (const QRect& run : runs) {
+                pixels.resize(4 * run.width() * run.height());
+                ReadRun(run, pixels.data());
+                CopyRun(run, pixels.data());
+            }
+        }
+    }
+}
+
+std::vector<QRect> Layer::TakeDirtyRuns(unsigned int column, unsigned int row) {
+    std::vector<QRect> runs;
+    unsigned int first_column = column * CELLS_PER_TILE;
+    unsigned int end_column = std::min(cell_columns_, first_column + CELLS_PER_TILE);
+    unsigned int end_row = std::min(cell_rows_, (row + 1) * CELLS_PER_TILE);
+    for (unsigned int cell_row = row * CELLS_PER_TILE; cell_row < end_row; cell_row++) {
+        unsigned int top = cell_row * CELL_SIZE;
+        unsigned int run_height = height_ - top < CELL_SIZE ? height_ - top : CELL_SIZE;
+        unsigned int cell = first_column;
+        while (cell < end_column) {
+            if (!dirty_cells_[cell_row * cell_columns_ + cell]) {
+                cell++;
+                continue;
+            }
+            // Read neighbouring dirty cells in one go
+            unsigned int first = cell;
+            while (cell < end_column && dirty_cells_[cell_row * cell_columns_ + cell]) {
+                dirty_cells_[cell_row * cell_columns_ + cell] = 0;
+                cell++;
+            }
+            unsigned int left = first * CELL_SIZE;
+            unsigned int run_width = std::min(cell * CELL_SIZE, width_) - left;
+            runs.push_back(QRect(left, top, run_width, run_height));
+        }
+    }
+    return runs;
+}
+
+void Layer::ReadRun(const QRect& run, void* pixels) {
+    unsigned int column = run.x() / TILE_SIZE;
+    unsigned int row = run.y() / TILE_SIZE;
+    gpu_tiles_[row * contents_.GetColumns() + column].framebuffer->bind();
+    glReadPixels(run.x() - column * TILE_SIZE, (row + 1) * TILE_SIZE - 1 - run.bottom(), run.width(), run.height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+void Layer::CopyRun(const QRect& run, const unsigned char* pixels) {
+    // The framebuffers store the bottom row first
+    ptrdiff_t row_size = 4 * run.width();
+    contents_.Write(run, pixels + (run.height() - 1) * row_size, -row_size);
+}
@@ -2,16 +2,142 @@
 #define LAYER_H
 
 #include <glinclude.h>
+#include <rgbabuffer.h>
+#include <vectors.h>
+#include <strokebatch.h>
+#include <tiledimage.h>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#include <QRect>
 
-// Each Layer encapulates a framebuffer to be drawn on.
+// Each Layer is a canvas to be drawn on, split in tiles so very large ones only cost memory where they were painted.
+// The pixels live in a TiledImage on the CPU, paged to disk by the TileCache, and a tile only gets a framebuffer on the GPU
+// while it is drawn on or shown, up to GPU_TILE_BUDGET of them. Drawing on the GPU marks the cells it touches,
+// and Snapshot reads back only those.
+// Positions given to brushes count from the bottom left, rectangles and snapshots count rows from the top.
 class Layer {
 public:
+    static const unsigned int TILE_SIZE = TiledImage::TILE_SIZE;
+    // Framebuffers kept at most; beyond it the least recently used tile is read back and freed
+    static const unsigned int GPU_TILE_BUDGET = 512;
+
+    // Transparent until drawn on
     Layer(unsigned int width, unsigned int height);
+    // Completes the readbacks still in flight, so needs the layer's GL context to be current
+    ~Layer();
+
+    // Records that the next DrawStrokes draws within reach of pos, in the brush's coordinates
+    void MarkDirtyAround(const glm::vec2& pos, float reach);
+
+    // Draws batch on the tiles its dabs touch, with the brush positions as they are in pixels. Needs the layer's GL context to be current.
+    void DrawStrokes(StrokeBatch& batch);
+
+    // Draws batch on the CPU copy with the software rasterizer and copies the pixels it changed to the framebuffers.
+    // Nothing is left to read back, so the strokes need no MarkDirtyAround. Needs the layer's GL context to be current.
+    void RasterizeStrokes(StrokeBatch& batch);
+
+    // Calls draw for each tile overlapping area, with the tile's framebuffer bound and the viewport set to it.
+    // draw gets the matrix taking clip coordinates of the whole layer to the tile's, to apply after its projection. Needs the layer's GL context to be current.
+    void DrawTiles(const QRect& area, const std::function<void(const glm::mat4& tile_transform)>& draw);
+
+    // Gives the tiles overlapping area a framebuffer, e.g. before showing them, except those that are fully transparent
+    void PrepareTextures(const QRect& area);
 
-    QOpenGLFramebufferObject& Framebuffer() { return framebuffer_; }
+    // Calls draw for each tile overlapping area that has a framebuffer, with its texture and the bottom left corner of
+    // the tile in brush coordinates. Tiles are TILE_SIZE square even at the layer's edges.
+    void ForEachTexture(const QRect& area, const std::function<void(GLuint texture, const glm::vec2& origin)>& draw) const;
+
+    // Sets the layer to image, width x height RGBA32 like the layer, rows counting from the top or if flipped from the bottom.
+    // Needs the layer's GL context to be current.
+    void SetContents(const unsigned char* image, bool flipped);
+
+    // Sets the layer to a single color, which frees its tiles. Needs the layer's GL context to be current.
+    void SetContents(const glm::vec4& color);
+
+    // Up to date copy of the layer, in the row order of QOpenGLFramebufferObject::toImage. Needs the layer's GL context to be current.
+    // Each snapshot is a copy of its own, so it never changes afterwards.
+    std::shared_ptr<const RGBABuffer> Snapshot();
+
+    // Same as Snapshot, but only queues the readback into a pixel buffer and returns at once.
+    // The result is ready once CompleteReadbacks finds the GPU is done with it.
+    std::shared_future<std::shared_ptr<const RGBABuffer>> SnapshotAsync();
+
+    // Copies finished readbacks into the CPU copy and hands out their snapshots, in the order they were started.
+    // If wait is set, blocks until all of them are done. Returns whether any are still in flight.
+    bool CompleteReadbacks(bool wait);
 
 private:
-    QOpenGLFramebufferObject framebuffer_;
+    // Side of the square cells readbacks are tracked in, dividing TILE_SIZE
+    static const unsigned int CELL_SIZE = 64;
+    static const unsigned int CELLS_PER_TILE = TILE_SIZE / CELL_SIZE;
+
+    // A readback queued by SnapshotAsync
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+        // Areas read into the buffer one after the other, each within a tile
+        std::vector<QRect> runs;
+        std::promise<std::shared_ptr<const RGBABuffer>> promise;
+        std::shared_future<std::shared_ptr<const RGBABuffer>> result;
+    };
+
+    struct GpuTile {
+        // nullptr while the tile is only on the CPU
+        std::unique_ptr<QOpenGLFramebufferObject> framebuffer;
+        // Value of use_clock_ when last used, to find the least recently used
+        unsigned long long last_used;
+    };
+
+    // Marks the cells overlapping rect
+    void MarkCells(std::vector<char>& cells, const QRect& rect);
+
+    // Gives the tile a framebuffer holding its pixels if it has none, freeing another one if that goes over the budget
+    QOpenGLFramebufferObject& MakeResident(unsigned int column, unsigned int row);
+
+    // Reads back the tile's dirty cells and frees its framebuffer
+    void Evict(unsigned int column, unsigned int row);
+
+    // Copies area, within the tile, from the CPU copy to the tile's framebuffer
+    void UploadTile(unsigned int column, unsigned int row, const QRect& area);
+
+    // Bottom left corner of the tile in brush coordinates, where the framebuffer's first row is
+    glm::vec2 TileOrigin(unsigned int column, unsigned int row) const;
+
+    // The tiles overlapping area, clipped to the layer, as columns x rows; empty if none
+    QRect TilesAround(const QRect& area) const;
+
+    // Reads every dirty cell back into the CPU copy and waits for it
+    void ReadBackDirty();
+
+    // Clears the tile's dirty cells and returns them as horizontal runs of neighbouring cells
+    std::vector<QRect> TakeDirtyRuns(unsigned int column, unsigned int row);
+
+    // glReadPixels of run from the bound framebuffer of its tile, into pixels or at that offset of the bound pixel pack buffer
+    void ReadRun(const QRect& run, void* pixels);
+
+    // Copies the pixels of run, as glReadPixels returned them, into the CPU copy
+    void CopyRun(const QRect& run, const unsigned char* pixels);
+
+    unsigned int width_;
+    unsigned int height_;
+    TiledImage contents_;
+    // Row by row, like contents_'s tiles
+    std::vector<GpuTile> gpu_tiles_;
+    unsigned int resident_tiles_;
+    unsigned long long use_clock_;
+    unsigned int cell_columns_;
+    unsigned int cell_rows_;
+    // Cells whose CPU pixels are stale, row by row
+    std::vector<char> dirty_cells_;
+    // Cells the strokes batched for the next DrawStrokes reach, which become dirty once they are drawn
+    std::vector<char> pending_cells_;
+    // Queued by SnapshotAsync and not yet copied, oldest first
+    std::deque<std::unique_ptr<Readback>> readbacks_;
+    // Rows of an upload, bottom first as the framebuffers store them
+    std::vector<unsigned char> upload_pixels_;
 };
 
 #endif // LAYER_H
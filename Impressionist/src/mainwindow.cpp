@@ -2,6 +2,8 @@
 #include "ui_mainwindow.h"
 #include <brushes/brush.h>
 #include <filters/filter.h>
+#include <autopainter.h>
+#include <imageloader.h>
 #include <assert.h>
 #include <QScrollArea>
 #include <QOffscreenSurface>
@@ -9,6 +11,7 @@
 #include <QFileDialog>
 #include <QDebug>
 #include <QTimer>
+#include <QInputDialog>
 #include <math.h>
 
 #include <iostream>
@@ -25,9 +28,6 @@ MainWindow::MainWindow(QWidget *parent) :
     bilat_mean_dialog_(nullptr),
     bilat_gauss_dialog_(nullptr),
     mouse_buttons_(0),
-    reference_image_(nullptr),
-    reference_image_width_(0),
-    reference_image_height_(0),
     marker_brush_("Marker Brush"),
     angle_indicator_brush_("Angle Indicator Brush")
 {
@@ -71,6 +71,7 @@ MainWindow::MainWindow(QWidget *parent) :
 }
 
 MainWindow::~MainWindow() {
+    WaitForSave();
     delete ui;
 }
 
@@ -107,9 +108,7 @@ void MainWindow::CreateActions() {
                 QString filename = QFileDialog::getSaveFileName(this, tr("Save File"), MainWindow::LastPath, "Image Files (*.jpg | *.jpeg | *.png | *.bmp)");
                 if (!filename.isNull() && !filename.isEmpty()) {
                     MainWindow::LastPath = QFileInfo(filename).path();
-                    auto snapshot = right_view_->GetSnapshot();
-                    QImage image(snapshot->Bytes, snapshot->Width, snapshot->Height, QImage::Format_RGBA8888);
-                    image.mirrored().save(filename);
+                    SaveCanvas(filename);
                 }
                 break;
             }
@@ -127,23 +126,20 @@ void MainWindow::CreateActions() {
             MainWindow::LastPath = QFileInfo(filename).path();
 
             // Load the image from file into RGBA32 format
-            QImage unconverted(filename);
-            QImage image = unconverted.convertToFormat(QImage::Format_RGBA8888);
-            unsigned int width = image.width();
-            unsigned int height = image.height();
+            std::shared_ptr<const RGBABuffer> image = ImageLoader::Load(filename);
 
             // Make sure we were able to load the image
-            if (image.isNull()) {
+            if (!image) {
                 qDebug() << "Failed to import image \"" << filename << "\"";
                 return;
             }
+            unsigned int width = image->Width;
+            unsigned int height = image->Height;
 
-            // Keep a copy of the reference image
-            if (reference_image_ != nullptr) delete[] reference_image_;
-            reference_image_ = new unsigned char[image.byteCount()];
-            memcpy(reference_image_, image.bits(), image.byteCount());
-            reference_image_width_ = width;
-            reference_image_height_ = height;
+            // The reference view, the brushes and the gradient field share this one copy
+            reference_image_ = std::make_shared<const ReferenceImage>(image);
+            brush_dialog_->SetColorImage(reference_image_);
+            gradient_field_.Compute(reference_image_->GetPixels(), width, height, GRADIENT_SMOOTHING);
 
             // Construct the left and right hand side views
             left_view_->Setup(width, height);
@@ -157,7 +153,7 @@ void MainWindow::CreateActions() {
             ResizeCanvases(width, height);
 
             left_view_->SetCurrentLayer(PaintView::BASE_LAYER);
-            left_view_->DrawImage(image.bits(), width, height, true);
+            left_view_->DrawImage(reference_image_->GetPixels(), width, height, true);
 
             right_view_->SetCurrentLayer(PaintView::BASE_LAYER);
             right_view_->Clear(PaintView::RGBA_WHITE);
@@ -175,9 +171,7 @@ void MainWindow::CreateActions() {
         QString filename = QFileDialog::getSaveFileName(this, tr("Save File"), MainWindow::LastPath, "Image Files (*.jpg | *.jpeg | *.png | *.bmp)");
         if (!filename.isNull() && !filename.isEmpty()) {
             MainWindow::LastPath = QFileInfo(filename).path();
-            auto snapshot = right_view_->GetSnapshot();
-            QImage image(snapshot->Bytes, snapshot->Width, snapshot->Height, QImage::Format_RGBA8888);
-            image.mirrored().save(filename);
+            SaveCanvas(filename);
         }
     });
 
@@ -191,7 +185,7 @@ void MainWindow::CreateActions() {
     // Copy Reference image to Canvas
     connect(ui->copy_ref_action, &QAction::triggered, this, [this](){
         right_view_->SetCurrentLayer(PaintView::BASE_LAYER);
-        right_view_->DrawImage(reference_image_, reference_image_width_, reference_image_height_, true);
+        right_view_->DrawImage(reference_image_->GetPixels(), reference_image_->GetWidth(), reference_image_->GetHeight(), true);
         right_view_->update();
     });
 
@@ -200,6 +194,24 @@ void MainWindow::CreateActions() {
         brush_dialog_->show();
     });
 
+    // Paint the whole canvas from the reference with the current brush, its size being the finest layer's
+    connect(ui->auto_paint_action, &QAction::triggered, this, [this]() {
+        bool ok = false;
+        int layers = QInputDialog::getInt(this, tr("Auto Paint"), tr("Layers"), 3, 1, 6, 1, &ok);
+        if (!ok) return;
+        AutoPainter::Settings settings;
+        settings.layers = layers;
+        right_view_->SetCurrentLayer(PaintView::BASE_LAYER);
+        AutoPainter::Paint(reference_image_, brush_dialog_->GetCurrentBrush(), settings,
+                           [this](Brush& brush, const std::vector<AutoPainter::Dab>& dabs) { right_view_->DrawDabs(brush, dabs); },
+                           [this]() { return right_view_->GetSnapshot(); });
+    });
+
+    // Draw the brushes on the CPU, for drivers that get them wrong
+    connect(ui->software_brushes_action, &QAction::toggled, this, [this](bool checked) {
+        right_view_->SetSoftwareBrushes(checked);
+    });
+
     // Filters
     connect(ui->filter_kernel_action, &QAction::triggered, this, [this](){
         filter_kernel_dialog_->exec();
@@ -216,6 +228,21 @@ void MainWindow::CreateActions() {
         right_view_->DrawImage(filtered.Bytes, width, height);
     });
 
+    // Box approximated gaussian for large sigma, e.g. softening backgrounds
+    connect(ui->fast_gaussian_blur_action, &QAction::triggered, this, [this](){
+        bool ok = false;
+        double sigma = QInputDialog::getDouble(this, tr("Fast Gaussian Blur"), tr("Sigma"), 20.0, 1.0, 200.0, 1, &ok);
+        if (!ok) return;
+        auto snapshot = right_view_->GetSnapshot();
+        // Allocate space for the filtered image
+        unsigned int width = right_view_->GetWidth();
+        unsigned int height = right_view_->GetHeight();
+        RGBABuffer filtered(width, height);
+        // Apply the Filter
+        Filter::ApplyGaussianBlur(snapshot->Bytes, filtered.Bytes, width, height, sigma, BlurMode::Box);
+        right_view_->DrawImage(filtered.Bytes, width, height);
+    });
+
     connect(ui->bilat_mean_action, &QAction::triggered, this, [this](){
         bilat_mean_dialog_->exec();
     });
@@ -229,6 +256,23 @@ void MainWindow::CreateMenus() {
 
 }
 
+void MainWindow::SaveCanvas(const QString& filename) {
+    WaitForSave();
+    auto snapshot = right_view_->GetSnapshotAsync();
+    pending_save_ = std::async(std::launch::async, [snapshot, filename]() {
+        auto image_data = snapshot.get();
+        QImage image(image_data->Bytes, image_data->Width, image_data->Height, QImage::Format_RGBA8888);
+        image.mirrored().save(filename);
+    });
+}
+
+void MainWindow::WaitForSave() {
+    if (!pending_save_.valid()) return;
+    // The save may still be waiting for its readback, which only completes on this thread
+    right_view_->FinishReadbacks();
+    pending_save_.get();
+}
+
 void MainWindow::ResizeCanvases(unsigned int width, unsigned int height) {
     left_view_->setFixedSize(width, height);
     left_view_->update();
@@ -240,55 +284,6 @@ void MainWindow::ResizeCanvases(unsigned int width, unsigned int height) {
 
 float start_x, start_y;
 
-int MainWindow::calGradient(Brush& brush, glm::vec2 pos) {
-    float pos_x = pos[0];
-    float pos_y = pos[1];
-
-    glm::vec2 tempPos = {pos_x - 1, pos_y - 1};
-    glm::vec4 tempRGB = brush.GetColor(tempPos);
-    float y1 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x, pos_y - 1};
-    tempRGB = brush.GetColor(tempPos);
-    float y2 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x + 1, pos_y - 1};
-    tempRGB = brush.GetColor(tempPos);
-    float y3 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x - 1, pos_y};
-    tempRGB = brush.GetColor(tempPos);
-    float y4 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x + 1, pos_y};
-    tempRGB = brush.GetColor(tempPos);
-    float y6 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x - 1, pos_y + 1};
-    tempRGB = brush.GetColor(tempPos);
-    float y7 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x, pos_y + 1};
-    tempRGB = brush.GetColor(tempPos);
-    float y8 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    tempPos = {pos_x + 1, pos_y + 1};
-    tempRGB = brush.GetColor(tempPos);
-    float y9 = tempRGB.r * 0.299 + tempRGB.g * 0.578 + tempRGB.b * 0.114;
-
-    float sx = y1 * (-1) + y3 + y4 * (-2) + y6 * 2 + y7 * (-1) + y9;
-    float sy = y1  + y2 * 2 + y3 - y7 - 2 * y8 - y9;
-
-    float angle = 90 - atan2(sy, sx) * 180 / M_PI; // 90 dgrees to gradient angle
-
-    while (angle < 0) {
-        angle += 360;
-    }
-
-    return angle;
-}
-
-
 int smoothFactor = 5;
 std::vector<float> angles;
 
@@ -303,18 +298,18 @@ void MainWindow::CanvasMousePressed(QMouseEvent *event) {
         // Sample the Color from the reference image
         Brush& current_brush = brush_dialog_->GetCurrentBrush();
         current_brush.SetColorMode(ColorMode::Sample);
-        current_brush.SetColorImage(reference_image_, reference_image_width_, reference_image_height_);
         right_view_->SetCurrentLayer(PaintView::BASE_LAYER);
-        right_view_->DrawBegin(current_brush, pos);
         // REQUIREMENT: Set brush angle if needed.
+        if (brush_dialog_->GetCurrentAngleControl() == AngleMode::Gradient) {
+            current_brush.SetAngle(gradient_field_.GetAngle(pos));
+        }
+        right_view_->DrawBegin(current_brush, pos);
+        stroke_spacer_.Begin(pos);
         if(brush_dialog_->GetCurrentAngleControl() == AngleMode::CursorMovement) {
             start_x = pos_x;
             start_y = pos_y;
             angles.insert(angles.begin(), current_brush.GetAngle());
         }
-        if (brush_dialog_->GetCurrentAngleControl() == AngleMode::Gradient) {
-            current_brush.SetAngle(calGradient(current_brush, pos));
-        }
     } else if (mouse_buttons_.testFlag(Qt::RightButton)) {
         right_view_->SetCurrentLayer(PaintView::OVERLAY_LAYER);
         angle_indicator_brush_.SetColor(glm::vec3(1.0f, 0.0f, 0.0f));
@@ -334,9 +329,18 @@ void MainWindow::CanvasMouseMoved(QMouseEvent *event) {
         // Sample the Color from the reference image
         Brush& current_brush = brush_dialog_->GetCurrentBrush();
         current_brush.SetColorMode(ColorMode::Sample);
-        current_brush.SetColorImage(reference_image_, reference_image_width_, reference_image_height_);
         right_view_->SetCurrentLayer(PaintView::BASE_LAYER);
-        right_view_->DrawMove(current_brush, pos);
+        // Dabs go at even distances along the path rather than at each event
+        dabs_.clear();
+        stroke_spacer_.Move(pos, current_brush.GetSpacing(), dabs_);
+        if (brush_dialog_->GetCurrentAngleControl() == AngleMode::Gradient) {
+            // Each dab follows the gradient where it lands
+            gradient_dabs_.clear();
+            for (const glm::vec2& dab : dabs_) gradient_dabs_.push_back({ dab, gradient_field_.GetAngle(dab) });
+            right_view_->DrawDabs(current_brush, gradient_dabs_);
+        } else {
+            right_view_->DrawMoves(current_brush, dabs_);
+        }
         // REQUIREMENT: Set brush angle if needed.
         // Also consider the previous "smoothFactor" number of angles, average them
         if (brush_dialog_->GetCurrentAngleControl() == AngleMode::CursorMovement) {
@@ -368,9 +372,6 @@ void MainWindow::CanvasMouseMoved(QMouseEvent *event) {
             start_y = pos_y;
             brush_dialog_->GetCurrentBrush().SetAngle((int)smoothed);
         }
-        if (brush_dialog_->GetCurrentAngleControl() == AngleMode::Gradient) {
-            current_brush.SetAngle(calGradient(current_brush, pos));
-        }
     } else if (mouse_buttons_.testFlag(Qt::RightButton)) {
         right_view_->SetCurrentLayer(PaintView::OVERLAY_LAYER);
         right_view_->Clear(PaintView::RGBA_TRANSPARENT);
@@ -395,7 +396,6 @@ void MainWindow::CanvasMouseReleased(QMouseEvent *event) {
         // Sample the Color from the reference image
         Brush& current_brush = brush_dialog_->GetCurrentBrush();
         current_brush.SetColorMode(ColorMode::Sample);
-        current_brush.SetColorImage(reference_image_, reference_image_width_, reference_image_height_);
         right_view_->SetCurrentLayer(PaintView::BASE_LAYER);
         right_view_->DrawEnd(current_brush, pos);
     }
@@ -11,6 +11,11 @@
 #include <forms/brushdialog.h>
 #include <brushes/pointbrush.h>
 #include <brushes/linesegmentbrush.h>
+#include <brushes/strokespacer.h>
+#include <autopainter.h>
+#include <gradientfield.h>
+#include <referenceimage.h>
+#include <future>
 
 namespace Ui {
     class MainWindow;
@@ -27,6 +32,8 @@ private:
     const unsigned int DEFAULT_CANVAS_HEIGHT = 500;
     const unsigned int CANVAS_MARGIN = 50;
     const unsigned int CANVAS_SPACING = 6;
+    // Sigma of the blur steadying the gradient angle mode
+    const float GRADIENT_SMOOTHING = 1.0f;
 
     static QString LastPath; // Last path accessed in the file dialog
     Ui::MainWindow *ui;
@@ -42,11 +49,18 @@ private:
 
     // Mouse tracking
     Qt::MouseButtons mouse_buttons_;
+    // Places the dabs of the stroke being painted
+    StrokeSpacer stroke_spacer_;
+    std::vector<glm::vec2> dabs_;
+    std::vector<AutoPainter::Dab> gradient_dabs_;
 
-    // Copy of the reference image
-    unsigned char* reference_image_;
-    unsigned int reference_image_width_;
-    unsigned int reference_image_height_;
+    // The reference image, nullptr until one is loaded
+    std::shared_ptr<const ReferenceImage> reference_image_;
+    // Gradient of the reference image, for the gradient angle mode
+    GradientField gradient_field_;
+
+    // Canvas being written to disk in the background, see SaveCanvas
+    std::future<void> pending_save_;
 
     // Overlay Brushes
     PointBrush marker_brush_;
@@ -57,8 +71,10 @@ private:
     void CreateActions();
     void CreateMenus();
 
-    // Added
-    int calGradient(Brush& brush, glm::vec2 pos); //return the angle 90 degrees from gradient
+    // Saves the canvas without waiting for the readback or the encoding, so painting carries on meanwhile
+    void SaveCanvas(const QString& filename);
+    // Blocks until the last SaveCanvas has written its file
+    void WaitForSave();
 
     // Physically resizes the two paintview widgets and MainWindow to contain them
     void ResizeCanvases(unsigned int width, unsigned int height);
@@ -0,0 +1,92 @@
+#include "offscreencanvas.h"
+
+OffscreenCanvas::OffscreenCanvas() :
+    valid_(false),
+    width_(0),
+    height_(0)
+{
+    surface_.setFormat(QSurfaceFormat::defaultFormat());
+    surface_.create();
+    context_.setFormat(QSurfaceFormat::defaultFormat());
+    if (!surface_.isValid() || !context_.create()) return;
+    valid_ = true;
+
+    MakeCurrent();
+    stroke_batch_.Initialize();
+}
+
+OffscreenCanvas::~OffscreenCanvas() {
+    // The layer frees its framebuffer and readbacks through the context
+    if (valid_) MakeCurrent();
+    layer_.reset();
+}
+
+bool OffscreenCanvas::IsValid() const {
+    return valid_;
+}
+
+void OffscreenCanvas::Resize(unsigned int width, unsigned int height) {
+    MakeCurrent();
+    stroke_batch_.Clear();
+
+    width_ = width;
+    height_ = height;
+    layer_ = std::make_unique<Layer>(width_, height_);
+}
+
+void OffscreenCanvas::Clear(const glm::vec4& clear_color) {
+    if (!layer_) return;
+
+    MakeCurrent();
+    stroke_batch_.Clear();
+    layer_->SetContents(clear_color);
+}
+
+void OffscreenCanvas::DrawMoves(Brush& b, const std::vector<glm::vec2>& positions) {
+    if (!layer_) return;
+
+    MakeCurrent();
+    b.SetBatch(stroke_batch_);
+    for (const glm::vec2& pos : positions) {
+        b.BrushMove(pos);
+        layer_->MarkDirtyAround(pos, b.GetReach(pos));
+    }
+}
+
+void OffscreenCanvas::DrawDabs(Brush& b, const std::vector<AutoPainter::Dab>& dabs) {
+    if (!layer_) return;
+
+    MakeCurrent();
+    b.SetBatch(stroke_batch_);
+    for (const AutoPainter::Dab& dab : dabs) {
+        b.SetAngle(dab.angle);
+        b.BrushMove(dab.pos);
+        layer_->MarkDirtyAround(dab.pos, b.GetReach(dab.pos));
+    }
+}
+
+std::shared_ptr<const RGBABuffer> OffscreenCanvas::GetSnapshot() {
+    if (!layer_) return nullptr;
+
+    MakeCurrent();
+    FlushStrokes();
+    return layer_->Snapshot();
+}
+
+unsigned int OffscreenCanvas::GetWidth() const {
+    return width_;
+}
+
+unsigned int OffscreenCanvas::GetHeight() const {
+    return height_;
+}
+
+void OffscreenCanvas::MakeCurrent() {
+    context_.makeCurrent(&surface_);
+    glewInit();
+}
+
+void OffscreenCanvas::FlushStrokes() {
+    if (stroke_batch_.IsEmpty()) return;
+    layer_->DrawStrokes(stroke_batch_);
+}
@@ -0,0 +1,56 @@
+#ifndef OFFSCREENCANVAS_H
+#define OFFSCREENCANVAS_H
+
+#include <glinclude.h>
+#include <layer.h>
+#include <strokebatch.h>
+#include <autopainter.h>
+#include <brushes/brush.h>
+#include <memory>
+#include <vector>
+#include <QOffscreenSurface>
+
+// A canvas painted without a window, through its own GL context on an offscreen surface.
+// Brushes draw on it like on a PaintView, and GetSnapshot reads the result back.
+// Must be created and used on the GUI thread, which QOffscreenSurface requires.
+class OffscreenCanvas {
+public:
+    OffscreenCanvas();
+    ~OffscreenCanvas();
+
+    // Whether a GL context could be created
+    bool IsValid() const;
+
+    // Replaces the canvas with a width x height one
+    void Resize(unsigned int width, unsigned int height);
+
+    void Clear(const glm::vec4& clear_color);
+
+    // Draws a dab of b at each of positions, in the coordinates the brush sees on a PaintView
+    void DrawMoves(Brush& b, const std::vector<glm::vec2>& positions);
+    // Same as DrawMoves, turning the brush to each dab's angle first
+    void DrawDabs(Brush& b, const std::vector<AutoPainter::Dab>& dabs);
+
+    // The painted canvas, in the row order of PaintView::GetSnapshot
+    std::shared_ptr<const RGBABuffer> GetSnapshot();
+
+    unsigned int GetWidth() const;
+    unsigned int GetHeight() const;
+
+private:
+    void MakeCurrent();
+
+    // Draws the batched dabs onto the layer
+    void FlushStrokes();
+
+    QOffscreenSurface surface_;
+    QOpenGLContext context_;
+    bool valid_;
+
+    unsigned int width_;
+    unsigned int height_;
+    std::unique_ptr<Layer> layer_;
+    StrokeBatch stroke_batch_;
+};
+
+#endif // OFFSCREENCANVAS_H
@@ -14,48 +14,74 @@ const glm::vec4 PaintView::RGBA_TRANSPARENT = glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
 PaintView::PaintView(QWidget *parent) :
     QOpenGLWidget(parent),
     current_layer_(nullptr),
+    stroke_layer_(nullptr),
+    software_brushes_(false),
     width_(0),
     height_(0)
 {
     setMouseTracking(true);
+    // Readbacks take a frame or two, no need to poll more often than this
+    readback_timer_.setInterval(2);
+    connect(&readback_timer_, &QTimer::timeout, this, &PaintView::PollReadbacks);
 }
 
 void PaintView::DrawImage(const unsigned char* image, unsigned int width, unsigned int height, bool flipped) {
     if(current_layer_ == nullptr) return;
 
     makeCurrent();
-    current_layer_->Framebuffer().bind();
+    FlushStrokesBeforeOverwrite();
 
-    // Blending mode
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ZERO);
-
-    // Draw with the fullscreen quad
-    glBindVertexArray(canvas_vertex_array_);
-    glUseProgram(canvas_shader_);
-
-    // DPI projection (if framebuffer size is smaller than default framebuffer)
-    GLint uniform_loc = glGetUniformLocation(canvas_shader_, "projection_matrix");
-    glm::mat4 dpi_proj = flipped ? dpi_proj_flipped_ : dpi_proj_;
-    glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, glm::value_ptr(dpi_proj));
+    // The image replaced every pixel, so the layer's CPU copy can take it as is
+    if (width == width_ && height == height_) {
+        current_layer_->SetContents(image, flipped);
+        update();
+        return;
+    }
 
     // Load the data into the GPU buffer
-    glBindTexture(GL_TEXTURE_2D, canvas_texture_);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-
-    // Draw the quad
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    if (scaled_texture_.GetWidth() != width || scaled_texture_.GetHeight() != height) scaled_texture_.Allocate(width, height);
+    scaled_texture_.Upload(image);
+
+    // Stretch it over the fullscreen quad, one tile at a time
+    glm::mat4 projection = flipped ? glm::ortho(0.0f, float(width_), 0.0f, float(height_)) : glm::ortho(0.0f, float(width_), float(height_), 0.0f);
+    current_layer_->DrawTiles(QRect(0, 0, width_, height_), [&](const glm::mat4& tile_transform) {
+        // Blending mode
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ZERO);
+
+        glBindVertexArray(canvas_vertex_array_);
+        glUseProgram(canvas_shader_);
+        GLint uniform_loc = glGetUniformLocation(canvas_shader_, "projection_matrix");
+        glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, glm::value_ptr(tile_transform * projection));
+        glBindTexture(GL_TEXTURE_2D, scaled_texture_.Texture());
+
+        // Draw the quad
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    });
 
     update();
 }
 
-std::unique_ptr<RGBABuffer> PaintView::GetSnapshot() {
+std::shared_ptr<const RGBABuffer> PaintView::GetSnapshot() {
     makeCurrent();
+    FlushStrokes();
+    return current_layer_->Snapshot();
+}
+
+std::shared_future<std::shared_ptr<const RGBABuffer>> PaintView::GetSnapshotAsync() {
+    makeCurrent();
+    FlushStrokes();
+    auto result = current_layer_->SnapshotAsync();
+    readback_timer_.start();
+    return result;
+}
 
-    QImage image = current_layer_->Framebuffer().toImage().convertToFormat(QImage::Format_RGBA8888);
-    std::unique_ptr<RGBABuffer> snapshot = std::make_unique<RGBABuffer>(image.width(), image.height());
-    memcpy(snapshot->Bytes, image.constBits(), image.byteCount());
-    return std::move(snapshot);
+void PaintView::FinishReadbacks() {
+    makeCurrent();
+    for (auto& kv : layers_) {
+        kv.second->CompleteReadbacks(true);
+    }
+    readback_timer_.stop();
 }
 
 void PaintView::Setup(unsigned int width, unsigned int height) {
@@ -65,15 +91,13 @@ void PaintView::Setup(unsigned int width, unsigned int height) {
     height_ = height;
 
     // Clear all layers
+    stroke_batch_.Clear();
+    stroke_layer_ = nullptr;
     layers_.clear();
     current_layer_ = nullptr;
 
     // Fullscreen projection matrix
     canvas_proj_ = glm::ortho(0.0f, float(width_), float(height_), 0.0f);
-    // Framebuffer projection matrix compensating for DPI Scaling
-    float device_pixel_ratio = devicePixelRatio();
-    dpi_proj_ = glm::ortho(0.0f, width_ * device_pixel_ratio, float(height_), height_ - height_ * device_pixel_ratio);
-    dpi_proj_flipped_ = glm::ortho(0.0f, width_ * device_pixel_ratio, 0.0f, height_ * device_pixel_ratio);
 
     ResizeFullscreenQuad();
 }
@@ -82,12 +106,7 @@ void PaintView::CreateLayer(unsigned int layer_num, glm::vec4 clear_color) {
     makeCurrent();
 
     layers_[layer_num] = std::make_unique<Layer>(width_, height_);
-    layers_[layer_num]->Framebuffer().bind();
-
-    glClearColor(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    if(current_layer_ != nullptr) current_layer_->Framebuffer().bind();
+    layers_[layer_num]->SetContents(clear_color);
 }
 
 void PaintView::SetCurrentLayer(unsigned int layer_num) {
@@ -103,10 +122,8 @@ void PaintView::Clear(glm::vec4 clear_color) {
     if(current_layer_ == nullptr) return;
 
     makeCurrent();
-    current_layer_->Framebuffer().bind();
-
-    glClearColor(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
-    glClear(GL_COLOR_BUFFER_BIT);
+    FlushStrokesBeforeOverwrite();
+    current_layer_->SetContents(clear_color);
 
     update();
 }
@@ -119,6 +136,13 @@ unsigned int PaintView::GetHeight() {
     return height_;
 }
 
+QRect PaintView::GetVisibleRect() {
+    // Widget pixels match image pixels, but the widget's top row is the last row of a snapshot
+    QRect visible = visibleRegion().boundingRect().intersected(QRect(0, 0, width_, height_));
+    if (visible.isEmpty()) return QRect();
+    return QRect(visible.x(), height_ - 1 - visible.bottom(), visible.width(), visible.height());
+}
+
 void PaintView::mouseMoveEvent(QMouseEvent* event) {
     emit MouseMove(event);
 }
@@ -135,10 +159,9 @@ void PaintView::DrawBegin(Brush &b, glm::vec2 pos) {
     if(current_layer_ == nullptr) return;
 
     makeCurrent();
-    current_layer_->Framebuffer().bind();
-
     PrepareBrush(b);
     b.BrushBegin(pos);
+    MarkBrushDirty(b, pos);
 
     update();
 }
@@ -147,10 +170,36 @@ void PaintView::DrawMove(Brush &b, glm::vec2 pos) {
     if(current_layer_ == nullptr) return;
 
     makeCurrent();
-    current_layer_->Framebuffer().bind();
-
     PrepareBrush(b);
     b.BrushMove(pos);
+    MarkBrushDirty(b, pos);
+
+    update();
+}
+
+void PaintView::DrawMoves(Brush &b, const std::vector<glm::vec2>& positions) {
+    if(current_layer_ == nullptr || positions.empty()) return;
+
+    makeCurrent();
+    PrepareBrush(b);
+    for (const glm::vec2& pos : positions) {
+        b.BrushMove(pos);
+        MarkBrushDirty(b, pos);
+    }
+
+    update();
+}
+
+void PaintView::DrawDabs(Brush &b, const std::vector<AutoPainter::Dab>& dabs) {
+    if(current_layer_ == nullptr || dabs.empty()) return;
+
+    makeCurrent();
+    PrepareBrush(b);
+    for (const AutoPainter::Dab& dab : dabs) {
+        b.SetAngle(dab.angle);
+        b.BrushMove(dab.pos);
+        MarkBrushDirty(b, dab.pos);
+    }
 
     update();
 }
@@ -159,10 +208,9 @@ void PaintView::DrawEnd(Brush &b, glm::vec2 pos) {
     if(current_layer_ == nullptr) return;
 
     makeCurrent();
-    current_layer_->Framebuffer().bind();
-
     PrepareBrush(b);
     b.BrushEnd(pos);
+    MarkBrushDirty(b, pos);
 
     update();
 }
@@ -179,7 +227,6 @@ void PaintView::initializeGL() {
     context()->setShareContext(QOpenGLContext::globalShareContext());
 
     // Single-shot Initialization
-    SetupBrushShader();
     SetupCanvasShader();
     SetupFullscreenQuad();
     SetupBrushes();
@@ -192,6 +239,16 @@ void PaintView::initializeGL() {
 void PaintView::paintGL() {
     if(current_layer_ == nullptr) return;
 
+    // Bring the layers up to date and give the visible tiles their textures, then come back to the widget's own framebuffer
+    FlushStrokes();
+    // In the layers' rows, which count from the top like GetVisibleRect's
+    QRect visible = GetVisibleRect();
+    for (auto& kv : layers_) {
+        kv.second->PrepareTextures(visible);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    glViewport(0, 0, width() * devicePixelRatio(), height() * devicePixelRatio());
+
     // Clear before drawing
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -203,37 +260,22 @@ void PaintView::paintGL() {
     glBindVertexArray(canvas_vertex_array_);
     glUseProgram(canvas_shader_);
 
-    // Fullscreen projection
     GLint uniform_loc = glGetUniformLocation(canvas_shader_, "projection_matrix");
-    glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, glm::value_ptr(canvas_proj_));
 
     ResizeFullscreenQuad();
 
-    // Layers are rendered in ascending order of layer number
+    // Layers are rendered in ascending order of layer number, each tile by shrinking the fullscreen quad onto it
     for (auto& kv : layers_) {
-        glBindTexture(GL_TEXTURE_2D, kv.second->Framebuffer().texture());
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        kv.second->ForEachTexture(visible, [&](GLuint texture, const glm::vec2& origin) {
+            glm::mat4 tile_proj = glm::translate(canvas_proj_, glm::vec3(origin, 0.0f));
+            tile_proj = glm::scale(tile_proj, glm::vec3(float(Layer::TILE_SIZE) / width_, float(Layer::TILE_SIZE) / height_, 1.0f));
+            glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, glm::value_ptr(tile_proj));
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        });
     }
 }
 
-void PaintView::SetupBrushShader() {
-    GLuint brush_vert_shader = glCreateShader(GL_VERTEX_SHADER);
-    const char* brush_vert_cstr = brush_vert_source_.c_str();
-    glShaderSource(brush_vert_shader, 1, &brush_vert_cstr, NULL);
-    glCompileShader(brush_vert_shader);
-
-    GLuint brush_frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    const char* brush_frag_cstr = brush_frag_source_.c_str();
-    glShaderSource(brush_frag_shader, 1, &brush_frag_cstr, NULL);
-    glCompileShader(brush_frag_shader);
-
-    brush_shader_ = glCreateProgram();
-    glAttachShader(brush_shader_, brush_vert_shader);
-    glAttachShader(brush_shader_, brush_frag_shader);
-    glBindAttribLocation(brush_shader_, 0, "position");
-    glLinkProgram(brush_shader_);
-}
-
 void PaintView::SetupCanvasShader() {
     GLuint canvas_vert_shader = glCreateShader(GL_VERTEX_SHADER);
     const char* canvas_vert_cstr = canvas_vert_source_.c_str();
@@ -277,15 +319,6 @@ void PaintView::SetupFullscreenQuad() {
     glBufferData(GL_ARRAY_BUFFER, sizeof(float) * quad_uv.size(), quad_uv.data(), GL_STATIC_DRAW);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(1);
-
-    // Texture used for drawing to fullscreen quad
-    glGenTextures(1, &canvas_texture_);
-    glBindTexture(GL_TEXTURE_2D, canvas_texture_);
-    // Set texture properties
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 }
 
 void PaintView::ResizeFullscreenQuad() {
@@ -302,27 +335,48 @@ void PaintView::ResizeFullscreenQuad() {
 
 void PaintView::SetupBrushes() {
     // Create vertex array and vertex buffer used by brushes
-    glGenVertexArrays(1, &brush_vertex_array_);
-    glBindVertexArray(brush_vertex_array_);
-    glGenBuffers(1, &brush_pos_buffer_);
-    glBindBuffer(GL_ARRAY_BUFFER, brush_pos_buffer_);
-    // Enable the "position" vertex attribute
-    glEnableVertexAttribArray(0); // TODO: Not hardcoded
-    // Specify the vertex format
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    stroke_batch_.Initialize();
 }
 
-void PaintView::PrepareBrush(Brush& b) const {
-    glEnable(GL_BLEND);
-    // REQUIREMENT: Alpha Blend the RGB color for the Brush (don't modify the alpha channel)
-    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
+void PaintView::MarkBrushDirty(const Brush& b, glm::vec2 pos) {
+    // Rasterized strokes land in the layer's CPU copy as well, there is nothing to read back
+    if (software_brushes_) return;
+    // Brushes draw in widget coordinates, whose top row is the framebuffer's bottom one
+    current_layer_->MarkDirtyAround(pos, b.GetReach(pos));
+}
+
+void PaintView::SetSoftwareBrushes(bool enabled) {
+    if (enabled == software_brushes_) return;
+    // Strokes already batched are drawn the way they were started
+    makeCurrent();
+    FlushStrokes();
+    software_brushes_ = enabled;
+}
 
-    // DPI projection
-    glUseProgram(brush_shader_);
-    GLint uniform_loc = glGetUniformLocation(brush_shader_, "projection_matrix");
-    glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, glm::value_ptr(dpi_proj_flipped_));
+void PaintView::PollReadbacks() {
+    makeCurrent();
+    bool pending = false;
+    for (auto& kv : layers_) {
+        if (kv.second->CompleteReadbacks(false)) pending = true;
+    }
+    if (!pending) readback_timer_.stop();
+}
+
+void PaintView::PrepareBrush(Brush& b) {
+    // The batch only holds dabs for one layer
+    if (stroke_layer_ != current_layer_) FlushStrokes();
+    stroke_layer_ = current_layer_;
+    b.SetBatch(stroke_batch_);
+}
+
+void PaintView::FlushStrokes() {
+    if (stroke_batch_.IsEmpty()) return;
+    // Brush positions are layer pixels, whatever the screen's DPI scaling
+    if (software_brushes_) stroke_layer_->RasterizeStrokes(stroke_batch_);
+    else stroke_layer_->DrawStrokes(stroke_batch_);
+}
 
-    glBindVertexArray(brush_vertex_array_);
-    glBindBuffer(GL_ARRAY_BUFFER, brush_pos_buffer_);
-    b.SetColorLocation(glGetUniformLocation(brush_shader_, "brush_color"));
+void PaintView::FlushStrokesBeforeOverwrite() {
+    if (stroke_layer_ == current_layer_) stroke_batch_.Clear();
+    else FlushStrokes();
 }
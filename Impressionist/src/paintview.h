@@ -4,9 +4,14 @@
 #include <glinclude.h>
 #include <vectors.h>
 #include <unordered_map>
+#include <future>
 #include <memory>
+#include <QTimer>
 #include <rgbabuffer.h>
 #include <layer.h>
+#include <streamingtexture.h>
+#include <strokebatch.h>
+#include <autopainter.h>
 
 class Brush;
 
@@ -24,9 +29,16 @@ public:
     // Transfers the image onto the paint view. Flips the image vertically while doing so.
     void DrawImage(const unsigned char* image, unsigned int width, unsigned int height, bool flipped = false);
 
-    // Returns a deep copy of an image of the current layer.
-    // Note: This is an extremely expensive operation reading from GPU memory, use sparingly.
-    std::unique_ptr<RGBABuffer> GetSnapshot();
+    // Returns an image of the current layer, which never changes afterwards.
+    // Only the parts drawn since the last snapshot are read back from GPU memory, so repeated snapshots are cheap.
+    std::shared_ptr<const RGBABuffer> GetSnapshot();
+
+    // Same as GetSnapshot, but returns at once while the GPU copies the changed parts into a pixel buffer, so painting can go on.
+    // The result is filled in from the GUI thread's event loop, so only wait on it from other threads.
+    std::shared_future<std::shared_ptr<const RGBABuffer>> GetSnapshotAsync();
+
+    // Blocks until every GetSnapshotAsync result is ready, e.g. before waiting on one from the GUI thread
+    void FinishReadbacks();
 
     // Resets everything, clears all layers
     void Setup(unsigned int width, unsigned int height);
@@ -44,15 +56,26 @@ public:
     unsigned int GetWidth();
     unsigned int GetHeight();
 
+    // Part of the image currently visible on screen, e.g. inside the surrounding scroll area, in GetSnapshot's rows
+    QRect GetVisibleRect();
+
     // Forward signals to MainWindow
     virtual void mouseMoveEvent(QMouseEvent* event) override;
     virtual void mousePressEvent(QMouseEvent* event) override;
     virtual void mouseReleaseEvent(QMouseEvent* event) override;
 
-    // Draws with the brush on the current layer
+    // Draws with the brush on the current layer.
+    // The dabs are batched and reach the layer with the next frame, or sooner if something needs the layer's pixels.
     void DrawBegin(Brush& b, glm::vec2 pos);
     void DrawMove(Brush& b, glm::vec2 pos);
     void DrawEnd(Brush& b, glm::vec2 pos);
+    // Same as calling DrawMove at each of positions in turn
+    void DrawMoves(Brush& b, const std::vector<glm::vec2>& positions);
+    // Same as DrawMoves, turning the brush to each dab's angle first
+    void DrawDabs(Brush& b, const std::vector<AutoPainter::Dab>& dabs);
+
+    // Draws the brushes with the CPU rasterizer instead of the GPU, see StrokeBatch::Rasterize
+    void SetSoftwareBrushes(bool enabled);
 
 signals:
     void MouseMove(QMouseEvent* event);
@@ -60,22 +83,6 @@ signals:
     void MouseRelease(QMouseEvent* event);
 
 protected:
-    const std::string brush_vert_source_ =
-        "#version 150\n"
-        "in vec2 position;"
-        "uniform mat4 projection_matrix;"
-        "void main() {"
-        "   gl_Position = projection_matrix * vec4(position, 0.0, 1.0);"
-        "}";
-
-    const std::string brush_frag_source_ =
-        "#version 150\n"
-        "out vec4 outColor;"
-        "uniform vec4 brush_color;"
-        "void main() {"
-        "   outColor = brush_color;"
-        "}";
-
     const std::string canvas_vert_source_ =
         "#version 150\n"
         "in vec2 position;"
@@ -100,31 +107,41 @@ protected:
     virtual void initializeGL() override;
     virtual void paintGL() override;
     // Single-shot GL initialization
-    void SetupBrushShader();
     void SetupCanvasShader();
     void SetupFullscreenQuad();
     void ResizeFullscreenQuad();
     void SetupBrushes();
     // Called right before using the brush
-    void PrepareBrush(Brush& b) const;
+    void PrepareBrush(Brush& b);
+    // Draws the dabs batched since the last frame onto their layer
+    void FlushStrokes();
+    // Gets rid of the batched dabs, by drawing them unless the current layer is about to be overwritten anyway
+    void FlushStrokesBeforeOverwrite();
+    // Called right after the brush drew at pos, so snapshots pick up what it changed
+    void MarkBrushDirty(const Brush& b, glm::vec2 pos);
+    // Hands out the GetSnapshotAsync results the GPU has finished, stops readback_timer_ once none are left
+    void PollReadbacks();
 
     // Layers are keyed by their layer number
     std::map<unsigned int, std::unique_ptr<Layer>> layers_;
     Layer* current_layer_;
-    GLuint brush_vertex_array_;
-    GLuint brush_pos_buffer_;
+    // Polls for finished readbacks while any are in flight
+    QTimer readback_timer_;
+    // Dabs drawn since the last frame, all on stroke_layer_
+    StrokeBatch stroke_batch_;
+    Layer* stroke_layer_;
+    // Set by SetSoftwareBrushes, the batch is then rasterized on the CPU
+    bool software_brushes_;
     GLuint canvas_vertex_array_;
     GLuint canvas_pos_buffer_;
     GLuint canvas_uv_buffer_;
-    GLuint canvas_texture_;
-    GLuint brush_shader_;
+    // Texture DrawImage uploads images not of the canvas size to, like reduced previews, reallocated when that size changes
+    StreamingTexture scaled_texture_;
     GLuint canvas_shader_;
     unsigned int width_;
     unsigned int height_;
 
     glm::mat4 canvas_proj_;
-    glm::mat4 dpi_proj_;
-    glm::mat4 dpi_proj_flipped_;
 };
 
 #endif // PAINTVIEW_H
@@ -0,0 +1,195 @@
+#include "previewrenderer.h"
+#include <threadpool.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+PreviewRenderer::PreviewRenderer(QObject *parent) :
+    QObject(parent),
+    region_({ 0, 0, 0, 0 }),
+    halo_(0),
+    generation_(0),
+    result_generation_(0),
+    pending_(false),
+    busy_(false),
+    stopping_(false),
+    cancelled_(false)
+{
+    worker_ = std::thread(&PreviewRenderer::WorkerLoop, this);
+}
+
+PreviewRenderer::~PreviewRenderer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        cancelled_ = true;
+    }
+    wake_.notify_all();
+    worker_.join();
+}
+
+void PreviewRenderer::SetSource(std::shared_ptr<const RGBABuffer> source) {
+    Cancel();
+    std::lock_guard<std::mutex> lock(mutex_);
+    source_ = source;
+}
+
+void PreviewRenderer::SetRegion(const QRect& region) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (region.isEmpty()) region_ = { 0, 0, 0, 0 };
+    else region_ = { (unsigned int)region.x(), (unsigned int)region.y(), (unsigned int)region.width(), (unsigned int)region.height() };
+}
+
+void PreviewRenderer::Start(FilterFunction filter, unsigned int halo) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cancelled_ = true;
+        generation_++;
+        filter_ = filter;
+        halo_ = halo;
+        pending_ = true;
+        result_.reset();
+    }
+    wake_.notify_all();
+}
+
+void PreviewRenderer::Cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    generation_++;
+    pending_ = false;
+    result_.reset();
+}
+
+void PreviewRenderer::Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this]() { return !pending_ && !busy_; });
+}
+
+std::unique_ptr<RGBABuffer> PreviewRenderer::TakeResult() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (result_generation_ != generation_) return nullptr;
+    return std::move(result_);
+}
+
+void PreviewRenderer::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this]() { return stopping_ || pending_; });
+        if (stopping_) return;
+
+        pending_ = false;
+        busy_ = true;
+        cancelled_ = false;
+        FilterFunction filter = filter_;
+        unsigned int halo = halo_;
+        std::shared_ptr<const RGBABuffer> source = source_;
+        ImageRegion region = region_;
+        unsigned long generation = generation_;
+
+        lock.unlock();
+        if (source) Render(filter, halo, source, region, generation);
+        lock.lock();
+
+        busy_ = false;
+        idle_.notify_all();
+    }
+}
+
+void PreviewRenderer::Render(const FilterFunction& filter, unsigned int halo, const std::shared_ptr<const RGBABuffer>& source, const ImageRegion& region, unsigned long generation) {
+    // Filters notice a cancel between row bands instead of running to completion
+    ThreadPool::CancelScope cancel_scope(cancelled_);
+
+    unsigned int width = source->Width;
+    unsigned int height = source->Height;
+    // The region pass only pays off when the region is a small part of the image
+    bool region_pass = region.width > 0 && region.height > 0 && 2 * (unsigned long long)region.width * region.height <= (unsigned long long)width * height;
+    // What the region pass draws over, until the full size pass replaces it
+    std::unique_ptr<RGBABuffer> backdrop;
+
+    unsigned int pixels = width * height;
+    if (pixels > PREVIEW_PIXELS) {
+        unsigned int factor = (unsigned int)std::ceil(std::sqrt((double)pixels / PREVIEW_PIXELS));
+        if (reduced_for_.lock() != source) {
+            reduced_ = Downscale(*source, factor);
+            reduced_for_ = source;
+        }
+        if (cancelled_) {
+            // The copy may be incomplete
+            reduced_for_.reset();
+            return;
+        }
+        std::unique_ptr<RGBABuffer> preview(new RGBABuffer(reduced_->Width, reduced_->Height));
+        filter(reduced_->Bytes, preview->Bytes, reduced_->Width, reduced_->Height, factor);
+        if (region_pass) backdrop = Upscale(*preview, factor, width, height);
+        if (!Deliver(std::move(preview), generation)) return;
+    }
+
+    if (region_pass) {
+        if (!backdrop) {
+            backdrop.reset(new RGBABuffer(width, height));
+            memcpy(backdrop->Bytes, source->Bytes, source->Size);
+        }
+        Filter::ApplyToRegion(source->Bytes, backdrop->Bytes, width, height, region, halo,
+                              [&filter](const unsigned char* crop, unsigned char* filtered, unsigned int crop_width, unsigned int crop_height) {
+            filter(crop, filtered, crop_width, crop_height, 1.0f);
+        });
+        if (!Deliver(std::move(backdrop), generation)) return;
+    }
+
+    std::unique_ptr<RGBABuffer> filtered(new RGBABuffer(width, height));
+    filter(source->Bytes, filtered->Bytes, width, height, 1.0f);
+    Deliver(std::move(filtered), generation);
+}
+
+bool PreviewRenderer::Deliver(std::unique_ptr<RGBABuffer> result, unsigned long generation) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cancelled_ || generation != generation_) return false;
+        result_ = std::move(result);
+        result_generation_ = generation;
+    }
+    emit Ready();
+    return true;
+}
+
+std::unique_ptr<RGBABuffer> PreviewRenderer::Downscale(const RGBABuffer& source, unsigned int factor) {
+    unsigned int width = (source.Width + factor - 1) / factor;
+    unsigned int height = (source.Height + factor - 1) / factor;
+    std::unique_ptr<RGBABuffer> reduced(new RGBABuffer(width, height));
+    ThreadPool::Instance().ParallelFor(height, 16, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            // Blocks on the right and bottom edges may be cut short
+            unsigned int row_end = std::min((i + 1) * factor, source.Height);
+            for (unsigned int j = 0; j < width; j++) {
+                unsigned int column_end = std::min((j + 1) * factor, source.Width);
+                unsigned int totals[4] = { 0, 0, 0, 0 };
+                for (unsigned int y = i * factor; y < row_end; y++) {
+                    for (unsigned int x = j * factor; x < column_end; x++) {
+                        for (unsigned int p = 0; p < 4; p++) {
+                            totals[p] += source.Bytes[4 * (y * source.Width + x) + p];
+                        }
+                    }
+                }
+                unsigned int count = (row_end - i * factor) * (column_end - j * factor);
+                for (unsigned int p = 0; p < 4; p++) {
+                    reduced->Bytes[4 * (i * width + j) + p] = totals[p] / count;
+                }
+            }
+        }
+    });
+    return reduced;
+}
+
+std::unique_ptr<RGBABuffer> PreviewRenderer::Upscale(const RGBABuffer& reduced, unsigned int factor, unsigned int width, unsigned int height) {
+    std::unique_ptr<RGBABuffer> upscaled(new RGBABuffer(width, height));
+    ThreadPool::Instance().ParallelFor(height, 16, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            const unsigned char* row = reduced.Bytes + 4 * (i / factor) * reduced.Width;
+            for (unsigned int j = 0; j < width; j++) {
+                memcpy(upscaled->Bytes + 4 * (i * width + j), row + 4 * (j / factor), 4);
+            }
+        }
+    });
+    return upscaled;
+}
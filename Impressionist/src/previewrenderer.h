@@ -0,0 +1,94 @@
+#ifndef PREVIEWRENDERER_H
+#define PREVIEWRENDERER_H
+
+#include <rgbabuffer.h>
+#include <filters/filter.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <QObject>
+#include <QRect>
+
+// Computes filter previews on a background thread so the dialogs stay responsive.
+// Large images are first filtered at a reduced size for a quick look, then the visible region at full size, then everything.
+// Starting a new preview cancels the one in progress; results of cancelled previews are never handed out.
+class PreviewRenderer : public QObject {
+    Q_OBJECT
+public:
+    // Filters source into dest, both width x height. scale is how many full size pixels one source pixel covers,
+    // so filters with parameters in pixels can divide them by it.
+    typedef std::function<void(const unsigned char* source, unsigned char* dest, unsigned int width, unsigned int height, float scale)> FilterFunction;
+
+    explicit PreviewRenderer(QObject *parent = 0);
+    ~PreviewRenderer();
+
+    // Sets the image the previews are computed from, cancelling the preview in progress
+    void SetSource(std::shared_ptr<const RGBABuffer> source);
+
+    // Sets the part of the image to refine first, usually what is on screen. An empty region skips that pass.
+    void SetRegion(const QRect& region);
+
+    // Cancels the preview in progress and starts computing a new one with filter.
+    // halo is how far the filter reads around a pixel at full size, see Filter::ApplyToRegion.
+    void Start(FilterFunction filter, unsigned int halo);
+
+    // Cancels the preview in progress, if any
+    void Cancel();
+
+    // Blocks until the current preview has finished at full size or was cancelled
+    void Wait();
+
+    // Takes the latest finished pass of the current preview, nullptr if there is none
+    std::unique_ptr<RGBABuffer> TakeResult();
+
+signals:
+    // A pass of the current preview finished. Emitted from the worker thread, so connections are queued.
+    void Ready();
+
+private:
+    // Images above this many pixels get a reduced first pass
+    static const unsigned int PREVIEW_PIXELS = 512 * 512;
+
+    void WorkerLoop();
+
+    // Runs the passes of one preview, stopping early if it is cancelled
+    void Render(const FilterFunction& filter, unsigned int halo, const std::shared_ptr<const RGBABuffer>& source, const ImageRegion& region, unsigned long generation);
+
+    // Hands a finished pass to the GUI thread, returns false if the preview was cancelled meanwhile
+    bool Deliver(std::unique_ptr<RGBABuffer> result, unsigned long generation);
+
+    // Averages factor x factor blocks of source into one pixel each
+    static std::unique_ptr<RGBABuffer> Downscale(const RGBABuffer& source, unsigned int factor);
+
+    // Scales reduced back up by factor, repeating pixels, and crops to width x height
+    static std::unique_ptr<RGBABuffer> Upscale(const RGBABuffer& reduced, unsigned int factor, unsigned int width, unsigned int height);
+
+    std::thread worker_;
+
+    // Guards everything below up to cancelled_
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::shared_ptr<const RGBABuffer> source_;
+    ImageRegion region_;
+    FilterFunction filter_;
+    unsigned int halo_;
+    // Bumped by every Start and Cancel, so stale results can be told apart
+    unsigned long generation_;
+    unsigned long result_generation_;
+    std::unique_ptr<RGBABuffer> result_;
+    bool pending_;
+    bool busy_;
+    bool stopping_;
+    // Read by the thread pool while a pass runs
+    std::atomic<bool> cancelled_;
+
+    // Reduced copy of the source, only touched by the worker
+    std::weak_ptr<const RGBABuffer> reduced_for_;
+    std::unique_ptr<RGBABuffer> reduced_;
+};
+
+#endif // PREVIEWRENDERER_H
@@ -0,0 +1,41 @@
+#include "referenceimage.h"
+#include <threadpool.h>
+
+ReferenceImage::ReferenceImage(std::shared_ptr<const RGBABuffer> image) {
+    levels_.push_back(image);
+    while (levels_.back()->Width > 1 || levels_.back()->Height > 1) {
+        levels_.push_back(Reduce(*levels_.back()));
+    }
+}
+
+std::shared_ptr<const RGBABuffer> ReferenceImage::Reduce(const RGBABuffer& source) {
+    unsigned int width = (source.Width + 1) / 2;
+    unsigned int height = (source.Height + 1) / 2;
+    std::shared_ptr<RGBABuffer> reduced = std::make_shared<RGBABuffer>(width, height);
+
+    ThreadPool::Instance().ParallelFor(height, 16, [&](unsigned int band_begin, unsigned int band_end) {
+        for (unsigned int i = band_begin; i < band_end; i++) {
+            // An odd last row or column is averaged with itself
+            const unsigned char* top = source.Bytes + 4 * (2 * i) * source.Width;
+            const unsigned char* bottom = 2 * i + 1 < source.Height ? top + 4 * source.Width : top;
+            unsigned char* out = reduced->Bytes + 4 * i * width;
+            for (unsigned int j = 0; j < width; j++) {
+                unsigned int left = 4 * (2 * j);
+                unsigned int right = 2 * j + 1 < source.Width ? left + 4 : left;
+                // Colors are weighted by alpha, so transparent pixels don't darken their neighbours
+                unsigned int alpha = top[left + 3] + top[right + 3] + bottom[left + 3] + bottom[right + 3];
+                for (unsigned int p = 0; p < 3; p++) {
+                    if (alpha == 0) {
+                        out[4 * j + p] = (top[left + p] + top[right + p] + bottom[left + p] + bottom[right + p] + 2) / 4;
+                        continue;
+                    }
+                    unsigned int weighted = top[left + p] * top[left + 3] + top[right + p] * top[right + 3] +
+                                            bottom[left + p] * bottom[left + 3] + bottom[right + p] * bottom[right + 3];
+                    out[4 * j + p] = (weighted + alpha / 2) / alpha;
+                }
+                out[4 * j + 3] = (alpha + 2) / 4;
+            }
+        }
+    });
+    return reduced;
+}
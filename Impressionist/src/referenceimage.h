@@ -0,0 +1,34 @@
+#ifndef REFERENCEIMAGE_H
+#define REFERENCEIMAGE_H
+
+#include <rgbabuffer.h>
+#include <memory>
+#include <vector>
+
+// The image being painted from, shared by the reference view, the brushes, the gradient field and the auto painter.
+// It never changes once made, so it is handed around as a shared_ptr<const ReferenceImage> that anyone, on any thread,
+// can keep reading for as long as they hold it. Rows are top first, like QImage's.
+// Alongside the image it keeps a mip chain: each level halves the one before, rounding up, down to a single pixel.
+class ReferenceImage {
+public:
+    // Shares image as level 0 and builds the rest of the chain on the thread pool
+    explicit ReferenceImage(std::shared_ptr<const RGBABuffer> image);
+
+    unsigned int GetWidth() const { return levels_[0]->Width; }
+    unsigned int GetHeight() const { return levels_[0]->Height; }
+    // Bytes from one row to the next
+    unsigned int GetStride() const { return 4 * levels_[0]->Width; }
+    const unsigned char* GetPixels() const { return levels_[0]->Bytes; }
+
+    // Level 0 is the image itself
+    unsigned int GetLevelCount() const { return levels_.size(); }
+    const RGBABuffer& GetLevel(unsigned int level) const { return *levels_[level]; }
+
+private:
+    // Next level of the chain, each pixel averaging the 2 x 2 block of source pixels it covers
+    static std::shared_ptr<const RGBABuffer> Reduce(const RGBABuffer& source);
+
+    std::vector<std::shared_ptr<const RGBABuffer>> levels_;
+};
+
+#endif // REFERENCEIMAGE_H
@@ -2,6 +2,7 @@
 #define RGBABUFFER_H
 
 #include <cstring>
+#include <functional>
 
 // Simple wrapper around an RGBA32 uchar buffer
 class RGBABuffer {
@@ -12,12 +13,26 @@ public:
         Height(height),
         Bytes(new unsigned char[Size]) { }
 
-    ~RGBABuffer() { delete[] Bytes; }
+    // Wraps pixels owned elsewhere, e.g. a mapped file, which release frees along with the buffer
+    RGBABuffer(unsigned int width, unsigned int height, unsigned char* bytes, std::function<void()> release) :
+        Size(width * height * 4),
+        Width(width),
+        Height(height),
+        Bytes(bytes),
+        release_(release) { }
+
+    ~RGBABuffer() {
+        if (release_) release_();
+        else delete[] Bytes;
+    }
 
     const unsigned int Size;
     const unsigned int Width;
     const unsigned int Height;
     unsigned char* Bytes;
+
+private:
+    std::function<void()> release_;
 };
 
 #endif // UCHARBUFFER_H
@@ -0,0 +1,80 @@
+#include "softwarecanvas.h"
+#include <cstring>
+
+SoftwareCanvas::SoftwareCanvas() {
+
+}
+
+bool SoftwareCanvas::IsValid() const {
+    return true;
+}
+
+void SoftwareCanvas::Resize(unsigned int width, unsigned int height) {
+    stroke_batch_.Clear();
+    contents_ = std::make_shared<RGBABuffer>(width, height);
+}
+
+void SoftwareCanvas::Clear(const glm::vec4& clear_color) {
+    if (!contents_) return;
+
+    stroke_batch_.Clear();
+    DetachContents();
+    // Same rounding as Layer::SetContents
+    unsigned char pixel[4];
+    for (unsigned int p = 0; p < 4; p++) {
+        pixel[p] = (unsigned char)(glm::clamp(clear_color[p], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+    for (unsigned int k = 0; k < contents_->Width * contents_->Height; k++) {
+        memcpy(contents_->Bytes + 4 * k, pixel, 4);
+    }
+}
+
+void SoftwareCanvas::DrawMoves(Brush& b, const std::vector<glm::vec2>& positions) {
+    if (!contents_) return;
+
+    b.SetBatch(stroke_batch_);
+    for (const glm::vec2& pos : positions) {
+        b.BrushMove(pos);
+    }
+}
+
+void SoftwareCanvas::DrawDabs(Brush& b, const std::vector<AutoPainter::Dab>& dabs) {
+    if (!contents_) return;
+
+    b.SetBatch(stroke_batch_);
+    for (const AutoPainter::Dab& dab : dabs) {
+        b.SetAngle(dab.angle);
+        b.BrushMove(dab.pos);
+    }
+}
+
+std::shared_ptr<const RGBABuffer> SoftwareCanvas::GetSnapshot() {
+    if (!contents_) return nullptr;
+
+    FlushStrokes();
+    return contents_;
+}
+
+unsigned int SoftwareCanvas::GetWidth() const {
+    return contents_ ? contents_->Width : 0;
+}
+
+unsigned int SoftwareCanvas::GetHeight() const {
+    return contents_ ? contents_->Height : 0;
+}
+
+void SoftwareCanvas::FlushStrokes() {
+    if (stroke_batch_.IsEmpty()) return;
+    DetachContents();
+    // Brushes count rows from the bottom, as on the PaintView's framebuffer
+    stroke_batch_.Rasterize(*contents_, true);
+}
+
+void SoftwareCanvas::DetachContents() {
+    // Snapshots handed out must never change
+    if (contents_.use_count() > 1) {
+        std::shared_ptr<RGBABuffer> copy = std::make_shared<RGBABuffer>(contents_->Width, contents_->Height);
+        memcpy(copy->Bytes, contents_->Bytes, contents_->Size);
+        contents_ = copy;
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef SOFTWARECANVAS_H
+#define SOFTWARECANVAS_H
+
+#include <rgbabuffer.h>
+#include <strokebatch.h>
+#include <autopainter.h>
+#include <brushes/brush.h>
+#include <memory>
+#include <vector>
+
+// A canvas painted without a GPU, with the same interface as OffscreenCanvas.
+// Brushes batch their dabs as usual, which the batch's software rasterizer draws into the canvas's pixels.
+// Needs no GL context, so it also works on machines without a display or driver.
+class SoftwareCanvas {
+public:
+    SoftwareCanvas();
+
+    // Always true, there is no context to fail
+    bool IsValid() const;
+
+    // Replaces the canvas with a width x height one
+    void Resize(unsigned int width, unsigned int height);
+
+    void Clear(const glm::vec4& clear_color);
+
+    // Draws a dab of b at each of positions, in the coordinates the brush sees on a PaintView
+    void DrawMoves(Brush& b, const std::vector<glm::vec2>& positions);
+    // Same as DrawMoves, turning the brush to each dab's angle first
+    void DrawDabs(Brush& b, const std::vector<AutoPainter::Dab>& dabs);
+
+    // The painted canvas, in the row order of PaintView::GetSnapshot
+    std::shared_ptr<const RGBABuffer> GetSnapshot();
+
+    unsigned int GetWidth() const;
+    unsigned int GetHeight() const;
+
+private:
+    // Draws the batched dabs onto contents_
+    void FlushStrokes();
+
+    // Copies contents_ first if a snapshot still shares it
+    void DetachContents();
+
+    std::shared_ptr<RGBABuffer> contents_;
+    StrokeBatch stroke_batch_;
+};
+
+#endif // SOFTWARECANVAS_H
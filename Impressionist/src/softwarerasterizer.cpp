@@ -0,0 +1,238 @@
+#include "softwarerasterizer.h"
+#include <threadpool.h>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    // Part of every x86-64 CPU, so unlike FilterSimd's wider paths it needs no runtime check
+    #define RASTERIZER_SSE2
+    #include <emmintrin.h>
+#endif
+
+SoftwareRasterizer::SoftwareRasterizer() {
+
+}
+
+void SoftwareRasterizer::AddDisc(const glm::vec2& center, float radius, const glm::vec4& color) {
+    primitives_.push_back({ Shape::Disc, (unsigned int)points_.size(), 1, std::abs(radius), color, 0, 0, 0, 0, 0, 0 });
+    points_.push_back(center);
+}
+
+void SoftwareRasterizer::AddPolygon(const glm::vec2* points, unsigned int count, const glm::vec4& color) {
+    if (count < 3) return;
+    primitives_.push_back({ Shape::Polygon, (unsigned int)points_.size(), count, 0.0f, color, 0, 0, 0, 0, 0, 0 });
+    points_.insert(points_.end(), points, points + count);
+}
+
+void SoftwareRasterizer::AddTriangleFan(const glm::vec2* points, unsigned int count, const glm::vec4& color) {
+    for (unsigned int i = 1; i + 1 < count; i++) {
+        glm::vec2 triangle[3] = { points[0], points[i], points[i + 1] };
+        AddPolygon(triangle, 3, color);
+    }
+}
+
+void SoftwareRasterizer::AddLine(const glm::vec2& from, const glm::vec2& to, float width, const glm::vec4& color) {
+    primitives_.push_back({ Shape::Line, (unsigned int)points_.size(), 2, 0.5f * std::abs(width), color, 0, 0, 0, 0, 0, 0 });
+    points_.push_back(from);
+    points_.push_back(to);
+}
+
+bool SoftwareRasterizer::IsEmpty() const {
+    return primitives_.empty();
+}
+
+void SoftwareRasterizer::Clear() {
+    points_.clear();
+    edges_.clear();
+    primitives_.clear();
+}
+
+QRect SoftwareRasterizer::Draw(RGBABuffer& target, bool bottom_up) {
+    return Draw(target.Width, target.Height, bottom_up, [&target](int left, int top) {
+        return TilePixels{ target.Bytes + 4 * (top * target.Width + left), 4 * (ptrdiff_t)target.Width };
+    });
+}
+
+QRect SoftwareRasterizer::Draw(TiledImage& target, bool bottom_up) {
+    return Draw(target.GetWidth(), target.GetHeight(), bottom_up, [&target](int left, int top) {
+        unsigned char* tile = target.GetTile(left / TiledImage::TILE_SIZE, top / TiledImage::TILE_SIZE);
+        return TilePixels{ tile + 4 * ((top % TiledImage::TILE_SIZE) * TiledImage::TILE_SIZE + left % TiledImage::TILE_SIZE), 4 * TiledImage::TILE_SIZE };
+    });
+}
+
+QRect SoftwareRasterizer::Draw(int width, int height, bool bottom_up, const std::function<TilePixels(int left, int top)>& pixels) {
+    QRect changed;
+    if (primitives_.empty() || width == 0 || height == 0) {
+        Clear();
+        return changed;
+    }
+
+    if (bottom_up) {
+        for (glm::vec2& point : points_) point.y = height - point.y;
+    }
+
+    // Edges and bounds, then the shapes touching each tile in the order they were added
+    unsigned int tile_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+    unsigned int tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector<std::vector<unsigned int>> tiles(tile_columns * tile_rows);
+    for (unsigned int index = 0; index < primitives_.size(); index++) {
+        Primitive& primitive = primitives_[index];
+        const glm::vec2* points = &points_[primitive.first_point];
+        glm::vec2 low = points[0];
+        glm::vec2 high = points[0];
+        for (unsigned int k = 1; k < primitive.point_count; k++) {
+            low = glm::min(low, points[k]);
+            high = glm::max(high, points[k]);
+        }
+        // One more pixel for the anti-aliased rim
+        float margin = primitive.size + 1.0f;
+        low -= glm::vec2(margin);
+        high += glm::vec2(margin);
+
+        if (primitive.shape == Shape::Polygon) {
+            float area = 0.0f;
+            for (unsigned int k = 0; k < primitive.point_count; k++) {
+                const glm::vec2& a = points[k];
+                const glm::vec2& b = points[(k + 1) % primitive.point_count];
+                area += a.x * b.y - b.x * a.y;
+            }
+            // Nothing to fill
+            if (area == 0.0f) continue;
+            float winding = area > 0.0f ? 1.0f : -1.0f;
+            primitive.first_edge = edges_.size();
+            for (unsigned int k = 0; k < primitive.point_count; k++) {
+                const glm::vec2& a = points[k];
+                glm::vec2 edge = points[(k + 1) % primitive.point_count] - a;
+                float length = glm::length(edge);
+                if (length == 0.0f) continue;
+                glm::vec2 normal = winding * glm::vec2(-edge.y, edge.x) / length;
+                edges_.push_back(glm::vec3(normal, -glm::dot(normal, a)));
+            }
+            primitive.edge_count = edges_.size() - primitive.first_edge;
+        }
+
+        primitive.left = std::max(0, (int)std::floor(low.x));
+        primitive.top = std::max(0, (int)std::floor(low.y));
+        primitive.right = std::min(width, (int)std::ceil(high.x));
+        primitive.bottom = std::min(height, (int)std::ceil(high.y));
+        if (primitive.left >= primitive.right || primitive.top >= primitive.bottom) continue;
+        changed |= QRect(primitive.left, primitive.top, primitive.right - primitive.left, primitive.bottom - primitive.top);
+
+        for (unsigned int row = primitive.top / TILE_SIZE; row <= (primitive.bottom - 1) / TILE_SIZE; row++) {
+            for (unsigned int column = primitive.left / TILE_SIZE; column <= (primitive.right - 1) / TILE_SIZE; column++) {
+                tiles[row * tile_columns + column].push_back(index);
+            }
+        }
+    }
+
+    // Looked up before filling, as the target may not be safe to use from several threads
+    std::vector<TilePixels> tile_pixels(tiles.size(), TilePixels{ nullptr, 0 });
+    for (unsigned int tile = 0; tile < tiles.size(); tile++) {
+        if (!tiles[tile].empty()) tile_pixels[tile] = pixels((tile % tile_columns) * TILE_SIZE, (tile / tile_columns) * TILE_SIZE);
+    }
+
+    // Tiles never share pixels, so they can be filled at the same time
+    ThreadPool::Instance().ParallelFor(tiles.size(), 1, [&](unsigned int tile_begin, unsigned int tile_end) {
+        float coverage[TILE_SIZE];
+        for (unsigned int tile = tile_begin; tile < tile_end; tile++) {
+            int tile_left = (tile % tile_columns) * TILE_SIZE;
+            int tile_top = (tile / tile_columns) * TILE_SIZE;
+            int tile_right = std::min(width, tile_left + (int)TILE_SIZE);
+            int tile_bottom = std::min(height, tile_top + (int)TILE_SIZE);
+            for (unsigned int index : tiles[tile]) {
+                const Primitive& primitive = primitives_[index];
+                Fill(primitive, tile_pixels[tile], tile_left, tile_top, std::max(tile_left, primitive.left), std::max(tile_top, primitive.top),
+                     std::min(tile_right, primitive.right), std::min(tile_bottom, primitive.bottom), coverage);
+            }
+        }
+    });
+
+    Clear();
+    return changed;
+}
+
+void SoftwareRasterizer::Fill(const Primitive& primitive, const TilePixels& tile, int tile_left, int tile_top, int left, int top, int right, int bottom, float* coverage) const {
+    if (left >= right || top >= bottom) return;
+    for (int y = top; y < bottom; y++) {
+        for (int x = left; x < right; x++) {
+            coverage[x - left] = Coverage(primitive, glm::vec2(x + 0.5f, y + 0.5f));
+        }
+        BlendSpan(tile.origin + (y - tile_top) * tile.stride + 4 * (left - tile_left), coverage, right - left, primitive.color);
+    }
+}
+
+float SoftwareRasterizer::Coverage(const Primitive& primitive, const glm::vec2& p) const {
+    // Distance inside the shape's outline, where half a pixel in is fully covered and half a pixel out not at all
+    float inside;
+    const glm::vec2* points = &points_[primitive.first_point];
+    switch (primitive.shape) {
+        case Shape::Disc:
+            inside = primitive.size - glm::length(p - points[0]);
+            break;
+        case Shape::Line: {
+            glm::vec2 along = points[1] - points[0];
+            float length_squared = glm::dot(along, along);
+            float t = length_squared > 0.0f ? glm::clamp(glm::dot(p - points[0], along) / length_squared, 0.0f, 1.0f) : 0.0f;
+            inside = primitive.size - glm::length(p - (points[0] + t * along));
+            break;
+        }
+        default: {
+            inside = primitive.edge_count > 0 ? INFINITY : -INFINITY;
+            for (unsigned int k = 0; k < primitive.edge_count; k++) {
+                const glm::vec3& edge = edges_[primitive.first_edge + k];
+                inside = std::min(inside, edge.x * p.x + edge.y * p.y + edge.z);
+            }
+            break;
+        }
+    }
+    return glm::clamp(inside + 0.5f, 0.0f, 1.0f);
+}
+
+void SoftwareRasterizer::BlendSpan(unsigned char* dest, const float* coverage, unsigned int count, const glm::vec4& color) {
+    // Same as glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE) with the source alpha scaled by coverage,
+    // in 0 to 255 and rounded to nearest like the framebuffer's conversion
+    float source[4] = {
+        255.0f * glm::clamp(color.r, 0.0f, 1.0f),
+        255.0f * glm::clamp(color.g, 0.0f, 1.0f),
+        255.0f * glm::clamp(color.b, 0.0f, 1.0f),
+        255.0f
+    };
+    float alpha = glm::clamp(color.a, 0.0f, 1.0f);
+    unsigned int k = 0;
+#ifdef RASTERIZER_SSE2
+    // One pixel per vector, the alpha lane adds instead of blending
+    const __m128 source_vector = _mm_loadu_ps(source);
+    const __m128 color_lanes = _mm_setr_ps(1.0f, 1.0f, 1.0f, 0.0f);
+    const __m128 alpha_lane = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 maximum = _mm_set1_ps(255.0f);
+    const __m128i zero = _mm_setzero_si128();
+    for (; k + 4 <= count; k += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(dest + 4 * k));
+        __m128i low = _mm_unpacklo_epi8(pixels, zero);
+        __m128i high = _mm_unpackhi_epi8(pixels, zero);
+        __m128i channels[4] = {
+            _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+            _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)
+        };
+        for (int p = 0; p < 4; p++) {
+            __m128 weight = _mm_set1_ps(alpha * coverage[k + p]);
+            __m128 dest_weight = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), weight), color_lanes), alpha_lane);
+            __m128 blended = _mm_add_ps(_mm_mul_ps(source_vector, weight), _mm_mul_ps(_mm_cvtepi32_ps(channels[p]), dest_weight));
+            channels[p] = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(blended, half), maximum));
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(channels[0], channels[1]), _mm_packs_epi32(channels[2], channels[3]));
+        _mm_storeu_si128((__m128i*)(dest + 4 * k), packed);
+    }
+#endif
+    // Pixels left over after the last full vector
+    for (; k < count; k++) {
+        float weight = alpha * coverage[k];
+        unsigned char* pixel = dest + 4 * k;
+        for (int p = 0; p < 4; p++) {
+            float dest_weight = (1.0f - weight) * (p < 3 ? 1.0f : 0.0f) + (p < 3 ? 0.0f : 1.0f);
+            float blended = source[p] * weight + pixel[p] * dest_weight;
+            pixel[p] = (unsigned char)std::min(blended + 0.5f, 255.0f);
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SOFTWARERASTERIZER_H
+#define SOFTWARERASTERIZER_H
+
+#include <rgbabuffer.h>
+#include <tiledimage.h>
+#include <vectors.h>
+#include <functional>
+#include <vector>
+#include <QRect>
+
+// Draws brush shapes into an RGBABuffer on the CPU, for machines without a GPU and for output that must not depend on the driver.
+// Shapes are anti-aliased from their distance to each pixel center and blended like the brushes are on the GPU:
+// color over the target by its alpha, alphas added. Draw bins the shapes into tiles and fills the tiles in parallel,
+// each in the order the shapes were added, so the result is the same as filling them one after the other.
+class SoftwareRasterizer {
+public:
+    SoftwareRasterizer();
+
+    void AddDisc(const glm::vec2& center, float radius, const glm::vec4& color);
+
+    // Convex polygon of count points, in either winding, e.g. a triangle or quad
+    void AddPolygon(const glm::vec2* points, unsigned int count, const glm::vec4& color);
+
+    // Triangles from points[0] to each following pair of points
+    void AddTriangleFan(const glm::vec2* points, unsigned int count, const glm::vec4& color);
+
+    // Segment of the given width, with round ends
+    void AddLine(const glm::vec2& from, const glm::vec2& to, float width, const glm::vec4& color);
+
+    bool IsEmpty() const;
+
+    // Drops everything added since the last Draw
+    void Clear();
+
+    // Blends everything added since the last Draw into target, in order, and clears the rasterizer.
+    // Positions are in pixels from the target's top left, or from its bottom left if bottom_up is set, like the framebuffers brushes draw on.
+    // Returns the part of target that may have changed, in its own rows.
+    QRect Draw(RGBABuffer& target, bool bottom_up);
+
+    // Same, into the tiles of target, storing the ones the shapes reach
+    QRect Draw(TiledImage& target, bool bottom_up);
+
+private:
+    // Side of the square tiles filled in parallel, which divides TiledImage's so each lies within one of them
+    static const unsigned int TILE_SIZE = 64;
+
+    // Pixel rows of a tile, from its top left pixel
+    struct TilePixels {
+        unsigned char* origin;
+        ptrdiff_t stride;
+    };
+
+    // Draws into a width x height target, whose tiles' pixels are looked up by pixels(left, top) before any are filled
+    QRect Draw(int width, int height, bool bottom_up, const std::function<TilePixels(int left, int top)>& pixels);
+
+    enum class Shape {
+        Disc,
+        Polygon,
+        Line
+    };
+
+    struct Primitive {
+        Shape shape;
+        // Disc: center. Line: both ends. Polygon: its corners.
+        unsigned int first_point;
+        unsigned int point_count;
+        // Disc radius or half the line width
+        float size;
+        glm::vec4 color;
+        // Polygons are tested against their edges, kept as n.x * x + n.y * y + c, the distance inside the edge
+        unsigned int first_edge;
+        unsigned int edge_count;
+        // Pixels that may be covered, clipped to the target
+        int left;
+        int top;
+        int right;
+        int bottom;
+    };
+
+    // Fills the pixels of primitive inside the rows [top, bottom) and columns [left, right) of the tile whose top left pixel is at tile_left, tile_top
+    void Fill(const Primitive& primitive, const TilePixels& tile, int tile_left, int tile_top, int left, int top, int right, int bottom, float* coverage) const;
+
+    // Coverage of the pixel centered on p, 0 to 1
+    float Coverage(const Primitive& primitive, const glm::vec2& p) const;
+
+    // Blends color into count pixels of dest, each weighted by its coverage
+    static void BlendSpan(unsigned char* dest, const float* coverage, unsigned int count, const glm::vec4& color);
+
+    std::vector<glm::vec2> points_;
+    std::vector<glm::vec3> edges_;
+    std::vector<Primitive> primitives_;
+};
+
+#endif // SOFTWARERASTERIZER_H
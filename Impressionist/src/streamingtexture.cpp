@@ -0,0 +1,79 @@
+#include "streamingtexture.h"
+#include <cstring>
+
+StreamingTexture::StreamingTexture() :
+    texture_(0),
+    width_(0),
+    height_(0),
+    next_buffer_(0)
+{
+    for (UploadBuffer& upload : buffers_) {
+        upload.buffer = 0;
+        upload.fence = nullptr;
+    }
+}
+
+void StreamingTexture::Allocate(unsigned int width, unsigned int height) {
+    Release();
+    width_ = width;
+    height_ = height;
+
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    // Set texture properties
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Immutable storage where available, otherwise plain storage that is simply never respecified
+#ifdef __APPLE__
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+#else
+    if (GLEW_ARB_texture_storage) glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    else glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+#endif
+
+    for (UploadBuffer& upload : buffers_) {
+        glGenBuffers(1, &upload.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, 4 * width * height, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void StreamingTexture::Upload(const unsigned char* image) {
+    UploadBuffer& upload = buffers_[next_buffer_];
+    next_buffer_ = (next_buffer_ + 1) % UPLOAD_BUFFER_COUNT;
+    unsigned int size = 4 * width_ * height_;
+
+    // The upload that last went through this buffer is normally long finished
+    if (upload.fence != nullptr) {
+        while (glClientWaitSync(upload.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(upload.fence);
+        upload.fence = nullptr;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    memcpy(mapped, image, size);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // Sources from the bound buffer, so the driver can copy it whenever the GPU is ready
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    upload.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamingTexture::Release() {
+    if (texture_ != 0) glDeleteTextures(1, &texture_);
+    texture_ = 0;
+    for (UploadBuffer& upload : buffers_) {
+        if (upload.fence != nullptr) glDeleteSync(upload.fence);
+        if (upload.buffer != 0) glDeleteBuffers(1, &upload.buffer);
+        upload.buffer = 0;
+        upload.fence = nullptr;
+    }
+    next_buffer_ = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef STREAMINGTEXTURE_H
+#define STREAMINGTEXTURE_H
+
+#include <glinclude.h>
+
+// Texture for images uploaded over and over at the same size, like filter previews.
+// Storage is allocated once, and each upload goes through the next of a ring of pixel unpack buffers,
+// so it neither reallocates the texture nor waits for draws still reading the previous image.
+class StreamingTexture {
+public:
+    StreamingTexture();
+
+    // (Re)creates the texture and its upload buffers for images of width x height. Needs a current GL context.
+    void Allocate(unsigned int width, unsigned int height);
+
+    // Replaces the texture with image, width x height RGBA32 as given to Allocate
+    void Upload(const unsigned char* image);
+
+    GLuint Texture() const { return texture_; }
+    unsigned int GetWidth() const { return width_; }
+    unsigned int GetHeight() const { return height_; }
+
+private:
+    // Enough that the buffer being filled is never one a recent upload still reads from
+    static const unsigned int UPLOAD_BUFFER_COUNT = 3;
+
+    struct UploadBuffer {
+        GLuint buffer;
+        // Signalled once the texture upload from buffer is done, nullptr if it was never used
+        GLsync fence;
+    };
+
+    // Deletes the texture and buffers, if any
+    void Release();
+
+    GLuint texture_;
+    unsigned int width_;
+    unsigned int height_;
+    UploadBuffer buffers_[UPLOAD_BUFFER_COUNT];
+    unsigned int next_buffer_;
+};
+
+#endif // STREAMINGTEXTURE_H
@@ -0,0 +1,417 @@
+#include "strokebatch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+StrokeBatch::StrokeBatch() :
+    color_(0.0f, 0.0f, 0.0f, 1.0f),
+    shader_(0),
+    mesh_buffer_(0),
+    vertex_array_(0),
+    stamp_vertex_array_(0),
+    buffer_(0),
+    mapped_(nullptr),
+    ring_offset_(0)
+{
+    for (GLsync& fence : fences_) fence = nullptr;
+    BuildMeshes();
+}
+
+void StrokeBatch::Initialize() {
+    SetupShader();
+
+    GLsizeiptr size = SEGMENT_SIZE * RING_SEGMENTS;
+
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+#ifndef __APPLE__
+    if (GLEW_ARB_buffer_storage) {
+        // Mapped once for good, filling the buffer is then a plain memcpy
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, size, nullptr, flags);
+        mapped_ = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    }
+#endif
+    if (mapped_ == nullptr) glBufferData(GL_ARRAY_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+    // Plain vertices, the attribute pointers are set for each upload
+    glGenVertexArrays(1, &vertex_array_);
+    glBindVertexArray(vertex_array_);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    // Stamps: the mesh positions per vertex, everything else per instance
+    glGenBuffers(1, &mesh_buffer_);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * mesh_positions_.size(), mesh_positions_.data(), GL_STATIC_DRAW);
+    glGenVertexArrays(1, &stamp_vertex_array_);
+    glBindVertexArray(stamp_vertex_array_);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    for (GLuint attribute = 1; attribute <= 4; attribute++) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+}
+
+void StrokeBatch::SetColor(const glm::vec4& color) {
+    color_ = color;
+}
+
+void StrokeBatch::AddStamp(Stamp stamp, const glm::vec2& pos, const glm::mat2& transform) {
+    if (runs_.empty() || !runs_.back().stamped || runs_.back().stamp != stamp) {
+        runs_.push_back({ true, meshes_[(int)stamp].mode, stamp, (unsigned int)instances_.size(), 0 });
+    }
+    runs_.back().count++;
+    instances_.push_back({
+        { pos.x, pos.y },
+        { transform[0].x, transform[0].y },
+        { transform[1].x, transform[1].y },
+        { color_.r, color_.g, color_.b, color_.a }
+    });
+}
+
+void StrokeBatch::AddLines(const std::vector<GLfloat>& positions) {
+    for (size_t i = 0; i + 3 < positions.size(); i += 4) {
+        Add(GL_LINES, positions[i], positions[i + 1]);
+        Add(GL_LINES, positions[i + 2], positions[i + 3]);
+    }
+}
+
+bool StrokeBatch::IsEmpty() const {
+    return runs_.empty();
+}
+
+void StrokeBatch::Clear() {
+    vertices_.clear();
+    instances_.clear();
+    runs_.clear();
+}
+
+void StrokeBatch::Draw(const glm::mat4& projection) {
+    if (runs_.empty()) return;
+
+    BeginDraw(projection);
+    for (const Run& run : runs_) {
+        if (run.stamped) DrawStamps(run.stamp, &instances_[run.first], run.count);
+        else DrawVertices(run.mode, &vertices_[run.first], run.count);
+    }
+    Clear();
+}
+
+void StrokeBatch::DrawTiled(unsigned int tile_size, unsigned int columns, unsigned int rows, float top,
+                            const std::function<glm::mat4(unsigned int column, unsigned int row)>& bind) {
+    if (runs_.empty()) return;
+
+    // Each dab, line or triangle goes to the tiles its bounds touch, in the order it was added
+    struct Item {
+        unsigned int run;
+        // Instance, or first vertex
+        unsigned int first;
+    };
+    std::vector<std::vector<Item>> tiles(columns * rows);
+    for (unsigned int index = 0; index < runs_.size(); index++) {
+        const Run& run = runs_[index];
+        unsigned int step = run.stamped ? 1 : run.mode == GL_LINES ? 2 : 3;
+        for (unsigned int i = run.first; i + step <= run.first + run.count; i += step) {
+            glm::vec2 low;
+            glm::vec2 high;
+            if (run.stamped) {
+                const Instance& instance = instances_[i];
+                glm::vec2 offset(instance.offset[0], instance.offset[1]);
+                glm::vec2 reach = meshes_[(int)run.stamp].extent *
+                    (glm::abs(glm::vec2(instance.axis_x[0], instance.axis_x[1])) + glm::abs(glm::vec2(instance.axis_y[0], instance.axis_y[1])));
+                low = offset - reach;
+                high = offset + reach;
+            } else {
+                low = high = glm::vec2(vertices_[i].position[0], vertices_[i].position[1]);
+                for (unsigned int k = 1; k < step; k++) {
+                    glm::vec2 position(vertices_[i + k].position[0], vertices_[i + k].position[1]);
+                    low = glm::min(low, position);
+                    high = glm::max(high, position);
+                }
+            }
+            // A pixel more for line widths and rounding
+            low -= glm::vec2(1.0f);
+            high += glm::vec2(1.0f);
+
+            int first_column = std::max(0, (int)std::floor(low.x / tile_size));
+            int last_column = std::min((int)columns - 1, (int)std::floor(high.x / tile_size));
+            int first_row = std::max(0, (int)std::floor((top - high.y) / tile_size));
+            int last_row = std::min((int)rows - 1, (int)std::floor((top - low.y) / tile_size));
+            for (int row = first_row; row <= last_row; row++) {
+                for (int column = first_column; column <= last_column; column++) {
+                    tiles[row * columns + column].push_back({ index, i });
+                }
+            }
+        }
+    }
+
+    std::vector<Instance> instances;
+    std::vector<Vertex> vertices;
+    for (unsigned int tile = 0; tile < tiles.size(); tile++) {
+        const std::vector<Item>& items = tiles[tile];
+        if (items.empty()) continue;
+
+        BeginDraw(bind(tile % columns, tile / columns));
+        // Items of the same run are next to each other, and drawn together
+        for (size_t k = 0; k < items.size();) {
+            const Run& run = runs_[items[k].run];
+            size_t end = k;
+            if (run.stamped) {
+                instances.clear();
+                for (; end < items.size() && items[end].run == items[k].run; end++) instances.push_back(instances_[items[end].first]);
+                DrawStamps(run.stamp, instances.data(), instances.size());
+            } else {
+                unsigned int step = run.mode == GL_LINES ? 2 : 3;
+                vertices.clear();
+                for (; end < items.size() && items[end].run == items[k].run; end++) {
+                    vertices.insert(vertices.end(), &vertices_[items[end].first], &vertices_[items[end].first] + step);
+                }
+                DrawVertices(run.mode, vertices.data(), vertices.size());
+            }
+            k = end;
+        }
+    }
+    Clear();
+}
+
+QRect StrokeBatch::Rasterize(RGBABuffer& target, bool bottom_up, float scale) {
+    AddToRasterizer(scale);
+    return rasterizer_.Draw(target, bottom_up);
+}
+
+QRect StrokeBatch::Rasterize(TiledImage& target, bool bottom_up, float scale) {
+    AddToRasterizer(scale);
+    return rasterizer_.Draw(target, bottom_up);
+}
+
+void StrokeBatch::AddToRasterizer(float scale) {
+    for (const Run& run : runs_) {
+        if (run.stamped) {
+            RasterizeStamps(run, scale);
+            continue;
+        }
+        // Plain vertices only ever come from AddLines, but triangles would work the same
+        unsigned int step = run.mode == GL_LINES ? 2 : 3;
+        for (unsigned int i = run.first; i + step <= run.first + run.count; i += step) {
+            const Vertex* vertex = &vertices_[i];
+            glm::vec4 color(vertex->color[0], vertex->color[1], vertex->color[2], vertex->color[3]);
+            auto position = [vertex, scale](int k) {
+                return scale * glm::vec2(vertex[k].position[0], vertex[k].position[1]);
+            };
+            if (run.mode == GL_LINES) {
+                rasterizer_.AddLine(position(0), position(1), 1.0f, color);
+            } else {
+                glm::vec2 triangle[3] = { position(0), position(1), position(2) };
+                rasterizer_.AddPolygon(triangle, 3, color);
+            }
+        }
+    }
+    Clear();
+}
+
+void StrokeBatch::RasterizeStamps(const Run& run, float scale) {
+    const Mesh& mesh = meshes_[(int)run.stamp];
+    const GLfloat* positions = &mesh_positions_[2 * mesh.first];
+    for (unsigned int i = run.first; i < run.first + run.count; i++) {
+        const Instance& instance = instances_[i];
+        glm::vec2 offset = scale * glm::vec2(instance.offset[0], instance.offset[1]);
+        glm::mat2 transform = scale * glm::mat2(glm::vec2(instance.axis_x[0], instance.axis_x[1]), glm::vec2(instance.axis_y[0], instance.axis_y[1]));
+        glm::vec4 color(instance.color[0], instance.color[1], instance.color[2], instance.color[3]);
+        auto vertex = [&](int k) {
+            return offset + transform * glm::vec2(positions[2 * k], positions[2 * k + 1]);
+        };
+
+        switch (run.stamp) {
+            case Stamp::Circle: {
+                float radius = glm::length(transform[0]);
+                // Scaled and turned circles stay circles, anything else is filled as its outline
+                if (std::abs(glm::dot(transform[0], transform[1])) <= 1e-3f * radius * radius &&
+                    std::abs(glm::length(transform[1]) - radius) <= 1e-3f * radius) {
+                    rasterizer_.AddDisc(offset, radius, color);
+                } else {
+                    std::vector<glm::vec2> outline;
+                    for (int k = 1; k < mesh.count; k += 3) outline.push_back(vertex(k));
+                    rasterizer_.AddPolygon(outline.data(), outline.size(), color);
+                }
+                break;
+            }
+            case Stamp::Square: {
+                // The two triangles as one quad, so their shared edge isn't blended twice
+                glm::vec2 quad[4] = { vertex(0), vertex(1), vertex(5), vertex(2) };
+                rasterizer_.AddPolygon(quad, 4, color);
+                break;
+            }
+            default:
+                if (mesh.mode == GL_LINES) {
+                    for (int k = 0; k + 1 < mesh.count; k += 2) rasterizer_.AddLine(vertex(k), vertex(k + 1), 1.0f, color);
+                } else {
+                    for (int k = 0; k + 2 < mesh.count; k += 3) {
+                        glm::vec2 triangle[3] = { vertex(k), vertex(k + 1), vertex(k + 2) };
+                        rasterizer_.AddPolygon(triangle, 3, color);
+                    }
+                }
+                break;
+        }
+    }
+}
+
+void StrokeBatch::BeginDraw(const glm::mat4& projection) {
+    glEnable(GL_BLEND);
+    // REQUIREMENT: Alpha Blend the RGB color for the Brush (don't modify the alpha channel)
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE);
+
+    glUseProgram(shader_);
+    GLint uniform_loc = glGetUniformLocation(shader_, "projection_matrix");
+    glUniformMatrix4fv(uniform_loc, 1, GL_FALSE, glm::value_ptr(projection));
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_);
+}
+
+void StrokeBatch::DrawStamps(Stamp stamp, const Instance* instances, unsigned int count) {
+    const Mesh& mesh = meshes_[(int)stamp];
+    glBindVertexArray(stamp_vertex_array_);
+    // Runs too long for a segment go in pieces
+    const unsigned int piece_size = SEGMENT_SIZE / sizeof(Instance);
+    for (unsigned int done = 0; done < count; done += piece_size) {
+        unsigned int piece = count - done < piece_size ? count - done : piece_size;
+        size_t offset = Upload(&instances[done], sizeof(Instance) * piece);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(offset + offsetof(Instance, color)));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(offset + offsetof(Instance, offset)));
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(offset + offsetof(Instance, axis_x)));
+        glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(offset + offsetof(Instance, axis_y)));
+        glDrawArraysInstanced(mesh.mode, mesh.first, mesh.count, piece);
+    }
+}
+
+void StrokeBatch::DrawVertices(GLenum mode, const Vertex* vertices, unsigned int count) {
+    glBindVertexArray(vertex_array_);
+    // Plain vertices are used as they are: no offset, identity transform
+    glVertexAttrib2f(2, 0.0f, 0.0f);
+    glVertexAttrib2f(3, 1.0f, 0.0f);
+    glVertexAttrib2f(4, 0.0f, 1.0f);
+    // Cut between whole triangles and lines
+    const unsigned int piece_size = SEGMENT_SIZE / sizeof(Vertex) / 6 * 6;
+    for (unsigned int done = 0; done < count; done += piece_size) {
+        unsigned int piece = count - done < piece_size ? count - done : piece_size;
+        size_t offset = Upload(&vertices[done], sizeof(Vertex) * piece);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, position)));
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)(offset + offsetof(Vertex, color)));
+        glDrawArrays(mode, 0, piece);
+    }
+}
+
+void StrokeBatch::Add(GLenum mode, GLfloat x, GLfloat y) {
+    if (runs_.empty() || runs_.back().stamped || runs_.back().mode != mode) {
+        runs_.push_back({ false, mode, Stamp::Count, (unsigned int)vertices_.size(), 0 });
+    }
+    runs_.back().count++;
+    vertices_.push_back({ { x, y }, { color_.r, color_.g, color_.b, color_.a } });
+}
+
+void StrokeBatch::SetupShader() {
+    GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
+    const char* vert_cstr = vert_source_.c_str();
+    glShaderSource(vert_shader, 1, &vert_cstr, NULL);
+    glCompileShader(vert_shader);
+
+    GLuint frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    const char* frag_cstr = frag_source_.c_str();
+    glShaderSource(frag_shader, 1, &frag_cstr, NULL);
+    glCompileShader(frag_shader);
+
+    shader_ = glCreateProgram();
+    glAttachShader(shader_, vert_shader);
+    glAttachShader(shader_, frag_shader);
+    glBindAttribLocation(shader_, 0, "position");
+    glBindAttribLocation(shader_, 1, "color");
+    glBindAttribLocation(shader_, 2, "offset");
+    glBindAttribLocation(shader_, 3, "axis_x");
+    glBindAttribLocation(shader_, 4, "axis_y");
+    glLinkProgram(shader_);
+}
+
+void StrokeBatch::BuildMeshes() {
+    std::vector<GLfloat>& positions = mesh_positions_;
+    auto begin = [this, &positions](Stamp stamp, GLenum mode) {
+        meshes_[(int)stamp] = { mode, GLint(positions.size() / 2), 0, 0.0f };
+    };
+    auto add = [this, &positions](Stamp stamp, float x, float y) {
+        positions.push_back(x);
+        positions.push_back(y);
+        meshes_[(int)stamp].count++;
+        meshes_[(int)stamp].extent = std::max(meshes_[(int)stamp].extent, std::max(std::abs(x), std::abs(y)));
+    };
+
+    // Fan around the center, as triangles
+    const int circle_triangles = 90;
+    begin(Stamp::Circle, GL_TRIANGLES);
+    for (int i = 0; i < circle_triangles; i++) {
+        add(Stamp::Circle, 0.0f, 0.0f);
+        add(Stamp::Circle, cos(i * 2 * M_PI / circle_triangles), sin(i * 2 * M_PI / circle_triangles));
+        add(Stamp::Circle, cos((i + 1) * 2 * M_PI / circle_triangles), sin((i + 1) * 2 * M_PI / circle_triangles));
+    }
+
+    // A small disc with 16 spikes, the first drawn twice like the brush always did
+    const float star_radius = 0.04f;
+    const int star_triangles = 30;
+    const int star_spikes = 16;
+    begin(Stamp::Star, GL_TRIANGLES);
+    for (int i = 0; i < star_triangles; i++) {
+        add(Stamp::Star, 0.0f, 0.0f);
+        add(Stamp::Star, -star_radius / 2 * cos(i * 2 * M_PI / star_triangles), -star_radius / 2 * sin(i * 2 * M_PI / star_triangles));
+        add(Stamp::Star, -star_radius / 2 * cos((i + 1) * 2 * M_PI / star_triangles), -star_radius / 2 * sin((i + 1) * 2 * M_PI / star_triangles));
+    }
+    for (int i = 0; i <= star_spikes; i++) {
+        float alpha = i * 2 * M_PI / star_spikes + M_PI / star_spikes;
+        add(Stamp::Star, -0.5f * cos(alpha), -0.5f * sin(alpha));
+        add(Stamp::Star, star_radius * sin(alpha), -star_radius * cos(alpha));
+        add(Stamp::Star, -star_radius * sin(alpha), star_radius * cos(alpha));
+    }
+
+    begin(Stamp::Square, GL_TRIANGLES);
+    add(Stamp::Square, -0.5f, -0.5f);
+    add(Stamp::Square, 0.5f, -0.5f);
+    add(Stamp::Square, -0.5f, 0.5f);
+    add(Stamp::Square, 0.5f, -0.5f);
+    add(Stamp::Square, -0.5f, 0.5f);
+    add(Stamp::Square, 0.5f, 0.5f);
+
+    // The glyph's line strip, as separate lines
+    const float uw[] = { -0.5f, -0.5f, -0.25f, 0.5f, 0.0f, 0.0f, 0.25f, 0.5f, 0.5f, -0.5f };
+    begin(Stamp::UW, GL_LINES);
+    for (int i = 0; i < 4; i++) {
+        add(Stamp::UW, uw[2 * i], uw[2 * i + 1]);
+        add(Stamp::UW, uw[2 * i + 2], uw[2 * i + 3]);
+    }
+}
+
+size_t StrokeBatch::Upload(const void* data, size_t size) {
+    size_t segment = ring_offset_ / SEGMENT_SIZE;
+    if (ring_offset_ + size > (segment + 1) * SEGMENT_SIZE) {
+        // Moving on, the GPU is done with this segment once it passes the fence
+        fences_[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % RING_SEGMENTS;
+        ring_offset_ = segment * SEGMENT_SIZE;
+        // Normally passed long ago, the draws reading it were a couple of frames back
+        if (fences_[segment] != nullptr) {
+            while (glClientWaitSync(fences_[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(fences_[segment]);
+            fences_[segment] = nullptr;
+        }
+    }
+    size_t offset = ring_offset_;
+    ring_offset_ += size;
+
+    if (mapped_ != nullptr) {
+        memcpy(mapped_ + offset, data, size);
+    } else {
+        // The fences already made sure the GPU is done with this range
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+        memcpy(glMapBufferRange(GL_ARRAY_BUFFER, offset, size, flags), data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    return offset;
+}
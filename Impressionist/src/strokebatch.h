@@ -0,0 +1,172 @@
+#ifndef STROKEBATCH_H
+#define STROKEBATCH_H
+
+#include <glinclude.h>
+#include <vectors.h>
+#include <rgbabuffer.h>
+#include <softwarerasterizer.h>
+#include <tiledimage.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Shapes brushes stamp, each built once as a unit mesh and placed by a per-dab transform
+enum class Stamp {
+    Circle, // Unit radius, 90 triangles
+    Star, // Star brush dab for size 1
+    Square, // Unit side, centered; also the line brush quad
+    UW, // UW glyph for size 1, in lines
+    Count
+};
+
+// Collects the geometry brushes draw until the next frame, so a whole frame of dabs goes to the GPU in one draw call.
+// Stamped dabs become instances of a prebuilt mesh, anything else plain lines, each carrying its own color
+// so dabs of different colors share a draw. Both reach the GPU through a ring buffer split in segments, each guarded by a fence.
+// A batch can also be drawn without a GPU by Rasterize, in which case it never needs a GL context.
+class StrokeBatch {
+public:
+    StrokeBatch();
+
+    // Creates the shader, vertex arrays and GPU buffers Draw uses. Needs a current GL context.
+    void Initialize();
+
+    // Color of the dabs added from now on
+    void SetColor(const glm::vec4& color);
+
+    // Draws stamp with its unit mesh transformed by transform and moved to pos
+    void AddStamp(Stamp stamp, const glm::vec2& pos, const glm::mat2& transform);
+
+    // Draws GL_LINES between the x, y pairs of positions
+    void AddLines(const std::vector<GLfloat>& positions);
+
+    bool IsEmpty() const;
+
+    // Drops everything added since the last Draw
+    void Clear();
+
+    // Draws everything added since the last Draw, in order, with the brush blending, and clears the batch.
+    // The caller binds the target; projection maps brush positions to it.
+    void Draw(const glm::mat4& projection);
+
+    // Same as Draw, on a grid of columns x rows tiles of tile_size, each dab going only to the tiles its bounds touch.
+    // Tile rows count down from top, like the rows of a snapshot: tile (column, row) covers brush positions from
+    // column * tile_size in x and from top - (row + 1) * tile_size in y. Before a tile's dabs are drawn, bind binds its
+    // target and returns the projection mapping brush positions to it.
+    void DrawTiled(unsigned int tile_size, unsigned int columns, unsigned int rows, float top,
+                   const std::function<glm::mat4(unsigned int column, unsigned int row)>& bind);
+
+    // Same as Draw, but blends the batch into target on the CPU. Circles become exact discs and everything is anti-aliased,
+    // so edges differ slightly from the GPU's. bottom_up is set when brush positions count rows from the bottom, as on a framebuffer.
+    // scale maps brush positions to pixels, like Draw's projection. Returns the part of target that may have changed.
+    QRect Rasterize(RGBABuffer& target, bool bottom_up, float scale = 1.0f);
+    QRect Rasterize(TiledImage& target, bool bottom_up, float scale = 1.0f);
+
+private:
+    // Vertex attribute 0 is the position, 1 the color and 2, 3, 4 the instance's offset and transform columns,
+    // placing each vertex at offset + mat2(axis_x, axis_y) * position
+    const std::string vert_source_ =
+        "#version 150\n"
+        "in vec2 position;"
+        "in vec4 color;"
+        "in vec2 offset;"
+        "in vec2 axis_x;"
+        "in vec2 axis_y;"
+        "out vec4 brush_color;"
+        "uniform mat4 projection_matrix;"
+        "void main() {"
+        "   brush_color = color;"
+        "   gl_Position = projection_matrix * vec4(offset + mat2(axis_x, axis_y) * position, 0.0, 1.0);"
+        "}";
+
+    const std::string frag_source_ =
+        "#version 150\n"
+        "in vec4 brush_color;"
+        "out vec4 outColor;"
+        "void main() {"
+        "   outColor = brush_color;"
+        "}";
+
+    // Bytes in each segment of the ring buffer; one segment is written while the GPU may still read the others
+    static const unsigned int SEGMENT_SIZE = 1 << 20;
+    static const unsigned int RING_SEGMENTS = 3;
+
+    struct Vertex {
+        GLfloat position[2];
+        GLfloat color[4];
+    };
+
+    struct Instance {
+        GLfloat offset[2];
+        GLfloat axis_x[2];
+        GLfloat axis_y[2];
+        GLfloat color[4];
+    };
+
+    // Part of the mesh buffer holding one stamp
+    struct Mesh {
+        GLenum mode;
+        GLint first;
+        GLsizei count;
+        // Largest coordinate of its vertices, bounding the dabs drawn with it
+        GLfloat extent;
+    };
+
+    // Consecutive vertices drawn with the same primitive, or instances of the same stamp
+    struct Run {
+        bool stamped;
+        GLenum mode;
+        Stamp stamp;
+        unsigned int first;
+        unsigned int count;
+    };
+
+    // Appends a vertex at x, y in the current color to a run of mode
+    void Add(GLenum mode, GLfloat x, GLfloat y);
+
+    void SetupShader();
+
+    // Fills in the unit meshes of every stamp
+    void BuildMeshes();
+
+    // Sets the blending, shader and projection every draw uses
+    void BeginDraw(const glm::mat4& projection);
+
+    // Draws count instances of stamp, or count plain vertices as mode
+    void DrawStamps(Stamp stamp, const Instance* instances, unsigned int count);
+    void DrawVertices(GLenum mode, const Vertex* vertices, unsigned int count);
+
+    // Hands the batch to the software rasterizer and clears it
+    void AddToRasterizer(float scale);
+
+    // Hands the instances of a run of stamps to the software rasterizer
+    void RasterizeStamps(const Run& run, float scale);
+
+    // Copies size bytes into the ring buffer where the GPU is done reading, returns their offset
+    size_t Upload(const void* data, size_t size);
+
+    std::vector<Vertex> vertices_;
+    std::vector<Instance> instances_;
+    std::vector<Run> runs_;
+    glm::vec4 color_;
+
+    GLuint shader_;
+    Mesh meshes_[(int)Stamp::Count];
+    // x, y pairs of every mesh, uploaded to mesh_buffer_
+    std::vector<GLfloat> mesh_positions_;
+    GLuint mesh_buffer_;
+    // Plain vertices, and instances of the meshes
+    GLuint vertex_array_;
+    GLuint stamp_vertex_array_;
+
+    GLuint buffer_;
+    // Persistent mapping of buffer_ if the driver supports ARB_buffer_storage, nullptr otherwise
+    char* mapped_;
+    // Next free byte in the ring buffer
+    size_t ring_offset_;
+    // Signalled once the GPU is done with a segment, nullptr while it is being written
+    GLsync fences_[RING_SEGMENTS];
+
+    SoftwareRasterizer rasterizer_;
+};
+
+#endif // STROKEBATCH_H
@@ -0,0 +1,174 @@
+#include "threadpool.h"
+#include <algorithm>
+
+namespace {
+    // Set while a thread is running a chunk, so nested ParallelFor calls don't wait on themselves
+    thread_local bool in_task = false;
+
+    // Flag of the innermost CancelScope on this thread
+    thread_local const std::atomic<bool>* cancel_flag = nullptr;
+}
+
+ThreadPool::CancelScope::CancelScope(const std::atomic<bool>& cancelled) :
+    previous_(cancel_flag)
+{
+    cancel_flag = &cancelled;
+}
+
+ThreadPool::CancelScope::~CancelScope() {
+    cancel_flag = previous_;
+}
+
+ThreadPool& ThreadPool::Instance() {
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::ThreadPool(unsigned int thread_count) :
+    generation_(0),
+    stopping_(false)
+{
+    StartWorkers(thread_count);
+}
+
+ThreadPool::~ThreadPool() {
+    StopWorkers();
+}
+
+void ThreadPool::SetThreadCount(unsigned int thread_count) {
+    std::lock_guard<std::mutex> job_lock(job_mutex_);
+    StopWorkers();
+    StartWorkers(thread_count);
+}
+
+unsigned int ThreadPool::GetThreadCount() const {
+    return workers_.size() + 1;
+}
+
+void ThreadPool::ParallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& task) {
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+    unsigned int chunk_count = (count + grain - 1) / grain;
+
+    // Nothing to share, or already inside a task
+    if (chunk_count == 1 || workers_.empty() || in_task) {
+        for (unsigned int begin = 0; begin < count; begin += grain) {
+            if (cancel_flag && *cancel_flag) return;
+            task(begin, std::min(begin + grain, count));
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> job_lock(job_mutex_);
+
+    Job job;
+    job.task = &task;
+    job.count = count;
+    job.grain = grain;
+    job.remaining = chunk_count;
+    job.cancelled = cancel_flag;
+
+    // Give each queue a contiguous run of chunks so neighbouring rows tend to stay on one thread
+    unsigned int queue_count = queues_.size();
+    for (unsigned int q = 0; q < queue_count; q++) {
+        std::lock_guard<std::mutex> lock(queues_[q]->mutex);
+        for (unsigned int c = q * chunk_count / queue_count; c < (q + 1) * chunk_count / queue_count; c++) {
+            queues_[q]->chunks.emplace_back(&job, c);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        generation_++;
+    }
+    wake_.notify_all();
+
+    // The calling thread works too
+    RunChunks(queue_count - 1);
+
+    std::unique_lock<std::mutex> lock(done_mutex_);
+    done_.wait(lock, [&job]() { return job.remaining == 0; });
+}
+
+void ThreadPool::StartWorkers(unsigned int thread_count) {
+    if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0) thread_count = 1;
+
+    stopping_ = false;
+    queues_.clear();
+    for (unsigned int q = 0; q < thread_count; q++) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (unsigned int w = 0; w + 1 < thread_count; w++) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this, w);
+    }
+}
+
+void ThreadPool::StopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+void ThreadPool::WorkerLoop(unsigned int queue_index) {
+    unsigned long seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_.wait(lock, [this, seen_generation]() { return stopping_ || generation_ != seen_generation; });
+            if (stopping_) return;
+            seen_generation = generation_;
+        }
+        RunChunks(queue_index);
+    }
+}
+
+void ThreadPool::RunChunks(unsigned int queue_index) {
+    std::pair<Job*, unsigned int> chunk;
+    while (TakeChunk(queue_index, chunk)) {
+        Job* job = chunk.first;
+        unsigned int begin = chunk.second * job->grain;
+        unsigned int end = std::min(begin + job->grain, job->count);
+
+        if (!job->cancelled || !*job->cancelled) {
+            in_task = true;
+            (*job->task)(begin, end);
+            in_task = false;
+        }
+
+        if (--job->remaining == 0) {
+            std::lock_guard<std::mutex> lock(done_mutex_);
+            done_.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::TakeChunk(unsigned int queue_index, std::pair<Job*, unsigned int>& chunk) {
+    // Own queue from the front
+    {
+        Queue& own = *queues_[queue_index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.chunks.empty()) {
+            chunk = own.chunks.front();
+            own.chunks.pop_front();
+            return true;
+        }
+    }
+    // Steal from the back of the others
+    for (unsigned int offset = 1; offset < queues_.size(); offset++) {
+        Queue& victim = *queues_[(queue_index + offset) % queues_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.chunks.empty()) {
+            chunk = victim.chunks.back();
+            victim.chunks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
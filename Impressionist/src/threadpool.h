@@ -0,0 +1,86 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Shared work-stealing pool that the filters dispatch their row bands through.
+// Work is split into fixed-size chunks before it is handed out, so how the work is divided never
+// depends on how many threads run it; each thread drains its own queue and then steals from the others.
+class ThreadPool {
+public:
+    // The process wide pool, sized to the hardware by default
+    static ThreadPool& Instance();
+
+    explicit ThreadPool(unsigned int thread_count = 0);
+    ~ThreadPool();
+
+    // Number of threads running work, including the calling thread. 0 picks the hardware concurrency.
+    void SetThreadCount(unsigned int thread_count);
+    unsigned int GetThreadCount() const;
+
+    // Calls task(begin, end) for consecutive chunks of grain items covering [0, count) and blocks until all are done.
+    // Calls made from inside a task run serially on the calling thread.
+    void ParallelFor(unsigned int count, unsigned int grain, const std::function<void(unsigned int, unsigned int)>& task);
+
+    // While alive, ParallelFor calls made from the constructing thread skip every chunk not yet started once cancelled is set.
+    // Whatever those calls were computing is left incomplete and should be thrown away.
+    class CancelScope {
+    public:
+        explicit CancelScope(const std::atomic<bool>& cancelled);
+        ~CancelScope();
+
+    private:
+        const std::atomic<bool>* previous_;
+    };
+
+private:
+    struct Job {
+        const std::function<void(unsigned int, unsigned int)>* task;
+        unsigned int count;
+        unsigned int grain;
+        std::atomic<unsigned int> remaining;
+        // Set by the caller's CancelScope, nullptr if it has none
+        const std::atomic<bool>* cancelled;
+    };
+
+    // Chunks waiting to run, tagged with the job they belong to
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::pair<Job*, unsigned int>> chunks;
+    };
+
+    void StartWorkers(unsigned int thread_count);
+    void StopWorkers();
+    void WorkerLoop(unsigned int queue_index);
+
+    // Runs chunks from the given queue, stealing from the others once it is empty
+    void RunChunks(unsigned int queue_index);
+    bool TakeChunk(unsigned int queue_index, std::pair<Job*, unsigned int>& chunk);
+
+    std::vector<std::thread> workers_;
+    // One queue per worker plus a last one for the thread calling ParallelFor
+    std::vector<std::unique_ptr<Queue>> queues_;
+
+    // Only one job runs at a time
+    std::mutex job_mutex_;
+
+    // Wakes the workers when a job is posted
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    unsigned long generation_;
+    bool stopping_;
+
+    // Signals the caller once the last chunk finishes
+    std::mutex done_mutex_;
+    std::condition_variable done_;
+};
+
+#endif // THREADPOOL_H
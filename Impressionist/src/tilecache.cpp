@@ -0,0 +1,108 @@
+#include "tilecache.h"
+#include <QDir>
+
+TileCache& TileCache::Instance() {
+    static TileCache cache;
+    return cache;
+}
+
+TileCache::TileCache(size_t budget) :
+    budget_(budget),
+    swap_size_(0)
+{
+
+}
+
+void TileCache::SetBudget(size_t budget) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_ = budget;
+    }
+    Trim();
+}
+
+size_t TileCache::GetBudget() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return budget_;
+}
+
+size_t TileCache::GetResidentBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return recent_.size() * TILE_BYTES;
+}
+
+unsigned int TileCache::Allocate() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    unsigned int id;
+    if (free_slots_.empty()) {
+        id = slots_.size();
+        slots_.emplace_back();
+    } else {
+        id = free_slots_.back();
+        free_slots_.pop_back();
+    }
+    Slot& slot = slots_[id];
+    slot.data.reset(new unsigned char[TILE_BYTES]);
+    slot.swap_offset = -1;
+    recent_.push_front(id);
+    slot.recent = recent_.begin();
+    return id;
+}
+
+void TileCache::Free(unsigned int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot& slot = slots_[id];
+    if (slot.data) recent_.erase(slot.recent);
+    slot.data.reset();
+    if (slot.swap_offset >= 0) free_swap_offsets_.push_back(slot.swap_offset);
+    slot.swap_offset = -1;
+    free_slots_.push_back(id);
+}
+
+unsigned char* TileCache::Data(unsigned int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Slot& slot = slots_[id];
+    if (slot.data) {
+        recent_.splice(recent_.begin(), recent_, slot.recent);
+        return slot.data.get();
+    }
+
+    slot.data.reset(new unsigned char[TILE_BYTES]);
+    swap_->seek(slot.swap_offset);
+    swap_->read((char*)slot.data.get(), TILE_BYTES);
+    // The caller may write to the pixels, so the copy on disk is stale from now on
+    free_swap_offsets_.push_back(slot.swap_offset);
+    slot.swap_offset = -1;
+    recent_.push_front(id);
+    slot.recent = recent_.begin();
+    return slot.data.get();
+}
+
+void TileCache::Trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (recent_.size() * TILE_BYTES > budget_) {
+        if (!PageOut(recent_.back())) return;
+    }
+}
+
+bool TileCache::PageOut(unsigned int id) {
+    if (!swap_) {
+        swap_.reset(new QTemporaryFile(QDir::temp().filePath("impressionist-tiles-XXXXXX")));
+        if (!swap_->open()) {
+            swap_.reset();
+            return false;
+        }
+    }
+
+    Slot& slot = slots_[id];
+    long long offset = swap_size_;
+    if (!free_swap_offsets_.empty()) offset = free_swap_offsets_.back();
+    if (!swap_->seek(offset) || swap_->write((const char*)slot.data.get(), TILE_BYTES) != (qint64)TILE_BYTES) return false;
+
+    if (offset == swap_size_) swap_size_ += TILE_BYTES;
+    else free_swap_offsets_.pop_back();
+    slot.swap_offset = offset;
+    slot.data.reset();
+    recent_.erase(slot.recent);
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QTemporaryFile>
+
+// Stores the pixels of image tiles, keeping at most a budget of them in memory and moving the least recently used
+// ones to a swap file beyond it. Tiles are referred to by the id Allocate returns.
+// Only Trim pages tiles out, so pointers from Data stay valid until then, also on other threads.
+class TileCache {
+public:
+    // Side of the square tiles, in pixels
+    static const unsigned int TILE_SIZE = 256;
+    // Bytes of one tile's RGBA pixels
+    static const size_t TILE_BYTES = 4 * TILE_SIZE * TILE_SIZE;
+
+    // The process wide cache
+    static TileCache& Instance();
+
+    // budget is the bytes of tiles kept in memory
+    explicit TileCache(size_t budget = size_t(1) << 30);
+
+    void SetBudget(size_t budget);
+    size_t GetBudget() const;
+
+    // Bytes of tiles in memory, which may go over the budget until the next Trim
+    size_t GetResidentBytes() const;
+
+    // Adds a tile with undefined pixels and returns its id
+    unsigned int Allocate();
+
+    void Free(unsigned int id);
+
+    // The tile's pixels, read back from the swap file first if they were paged out. Valid until the next Trim.
+    unsigned char* Data(unsigned int id);
+
+    // Pages out the least recently used tiles until the ones in memory fit the budget
+    void Trim();
+
+private:
+    struct Slot {
+        // nullptr while paged out
+        std::unique_ptr<unsigned char[]> data;
+        // Offset of the tile's copy in the swap file, -1 if it has none
+        long long swap_offset;
+        std::list<unsigned int>::iterator recent;
+    };
+
+    // Writes the tile to the swap file and frees its memory, or returns false if the file can't take it
+    bool PageOut(unsigned int id);
+
+    mutable std::mutex mutex_;
+    size_t budget_;
+    std::vector<Slot> slots_;
+    std::vector<unsigned int> free_slots_;
+    // Tiles in memory, most recently used first
+    std::list<unsigned int> recent_;
+
+    // Created on the first page out
+    std::unique_ptr<QTemporaryFile> swap_;
+    std::vector<long long> free_swap_offsets_;
+    long long swap_size_;
+};
+
+#endif // TILECACHE_H
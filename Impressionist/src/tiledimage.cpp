@@ -0,0 +1,117 @@
+#include "tiledimage.h"
+#include <algorithm>
+#include <cstring>
+
+TiledImage::TiledImage(unsigned int width, unsigned int height) :
+    width_(width),
+    height_(height),
+    columns_((width + TILE_SIZE - 1) / TILE_SIZE),
+    rows_((height + TILE_SIZE - 1) / TILE_SIZE),
+    tiles_(columns_ * rows_, Tile{ { 0, 0, 0, 0 }, NO_PIXELS })
+{
+
+}
+
+TiledImage::~TiledImage() {
+    for (Tile& tile : tiles_) {
+        if (tile.pixels != NO_PIXELS) TileCache::Instance().Free(tile.pixels);
+    }
+}
+
+void TiledImage::Fill(const unsigned char color[4]) {
+    for (Tile& tile : tiles_) SetUniform(tile, color);
+}
+
+bool TiledImage::IsUniform(unsigned int column, unsigned int row, unsigned char color[4]) const {
+    const Tile& tile = tiles_[row * columns_ + column];
+    if (tile.pixels != NO_PIXELS) return false;
+    memcpy(color, tile.color, 4);
+    return true;
+}
+
+unsigned char* TiledImage::GetTile(unsigned int column, unsigned int row) {
+    Tile& tile = tiles_[row * columns_ + column];
+    if (tile.pixels != NO_PIXELS) return TileCache::Instance().Data(tile.pixels);
+
+    tile.pixels = TileCache::Instance().Allocate();
+    unsigned char* pixels = TileCache::Instance().Data(tile.pixels);
+    for (unsigned int k = 0; k < TILE_SIZE * TILE_SIZE; k++) {
+        memcpy(pixels + 4 * k, tile.color, 4);
+    }
+    return pixels;
+}
+
+void TiledImage::Compact(unsigned int column, unsigned int row) {
+    Tile& tile = tiles_[row * columns_ + column];
+    if (tile.pixels == NO_PIXELS) return;
+
+    const unsigned char* pixels = TileCache::Instance().Data(tile.pixels);
+    unsigned int tile_width = width_ - column * TILE_SIZE < TILE_SIZE ? width_ - column * TILE_SIZE : TILE_SIZE;
+    unsigned int tile_height = height_ - row * TILE_SIZE < TILE_SIZE ? height_ - row * TILE_SIZE : TILE_SIZE;
+    for (unsigned int y = 0; y < tile_height; y++) {
+        const unsigned char* line = pixels + 4 * y * TILE_SIZE;
+        for (unsigned int x = 0; x < tile_width; x++) {
+            if (memcmp(line + 4 * x, pixels, 4) != 0) return;
+        }
+    }
+    unsigned char color[4];
+    memcpy(color, pixels, 4);
+    SetUniform(tile, color);
+}
+
+void TiledImage::Write(const QRect& rect, const unsigned char* pixels, ptrdiff_t stride) {
+    QRect clipped = rect.intersected(QRect(0, 0, width_, height_));
+    if (clipped.isEmpty()) return;
+    pixels += (clipped.y() - rect.y()) * stride + 4 * (clipped.x() - rect.x());
+
+    for (unsigned int row = clipped.top() / TILE_SIZE; row <= clipped.bottom() / TILE_SIZE; row++) {
+        for (unsigned int column = clipped.left() / TILE_SIZE; column <= clipped.right() / TILE_SIZE; column++) {
+            QRect part = clipped.intersected(QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE));
+            unsigned char* tile = GetTile(column, row);
+            for (int y = part.top(); y <= part.bottom(); y++) {
+                memcpy(tile + 4 * ((y % TILE_SIZE) * TILE_SIZE + part.x() % TILE_SIZE),
+                       pixels + (y - clipped.y()) * stride + 4 * (part.x() - clipped.x()), 4 * part.width());
+            }
+        }
+    }
+}
+
+void TiledImage::Read(const QRect& rect, unsigned char* pixels, ptrdiff_t stride) {
+    QRect clipped = rect.intersected(QRect(0, 0, width_, height_));
+    if (clipped.isEmpty()) return;
+    pixels += (clipped.y() - rect.y()) * stride + 4 * (clipped.x() - rect.x());
+
+    for (unsigned int row = clipped.top() / TILE_SIZE; row <= clipped.bottom() / TILE_SIZE; row++) {
+        for (unsigned int column = clipped.left() / TILE_SIZE; column <= clipped.right() / TILE_SIZE; column++) {
+            QRect part = clipped.intersected(QRect(column * TILE_SIZE, row * TILE_SIZE, TILE_SIZE, TILE_SIZE));
+            const Tile& tile = tiles_[row * columns_ + column];
+            // Reading never stores uniform tiles
+            const unsigned char* source = tile.pixels == NO_PIXELS ? nullptr : TileCache::Instance().Data(tile.pixels);
+            for (int y = part.top(); y <= part.bottom(); y++) {
+                unsigned char* line = pixels + (y - clipped.y()) * stride + 4 * (part.x() - clipped.x());
+                if (source) {
+                    memcpy(line, source + 4 * ((y % TILE_SIZE) * TILE_SIZE + part.x() % TILE_SIZE), 4 * part.width());
+                } else {
+                    for (int x = 0; x < part.width(); x++) memcpy(line + 4 * x, tile.color, 4);
+                }
+            }
+        }
+    }
+}
+
+std::shared_ptr<RGBABuffer> TiledImage::ToBuffer() {
+    std::shared_ptr<RGBABuffer> buffer = std::make_shared<RGBABuffer>(width_, height_);
+    // A row of tiles at a time, so the tiles read in from disk for it can be paged out again before the next
+    for (unsigned int row = 0; row < rows_; row++) {
+        unsigned int top = row * TILE_SIZE;
+        Read(QRect(0, top, width_, height_ - top < TILE_SIZE ? height_ - top : TILE_SIZE), buffer->Bytes + 4 * top * width_, 4 * width_);
+        TileCache::Instance().Trim();
+    }
+    return buffer;
+}
+
+void TiledImage::SetUniform(Tile& tile, const unsigned char color[4]) {
+    if (tile.pixels != NO_PIXELS) TileCache::Instance().Free(tile.pixels);
+    tile.pixels = NO_PIXELS;
+    memcpy(tile.color, color, 4);
+}
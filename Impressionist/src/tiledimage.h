@@ -0,0 +1,73 @@
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <rgbabuffer.h>
+#include <tilecache.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <QRect>
+
+// RGBA image split in square tiles, where a tile holding a single color is stored as just that color.
+// The other tiles keep their pixels in the TileCache, so memory follows the area that was painted rather than the image size.
+// Rows count from the top, like a Layer's snapshots.
+class TiledImage {
+public:
+    static const unsigned int TILE_SIZE = TileCache::TILE_SIZE;
+
+    // Transparent black until written
+    TiledImage(unsigned int width, unsigned int height);
+    ~TiledImage();
+
+    TiledImage(const TiledImage&) = delete;
+    TiledImage& operator=(const TiledImage&) = delete;
+
+    unsigned int GetWidth() const { return width_; }
+    unsigned int GetHeight() const { return height_; }
+    unsigned int GetColumns() const { return columns_; }
+    unsigned int GetRows() const { return rows_; }
+
+    // Sets every pixel to color, freeing all tiles
+    void Fill(const unsigned char color[4]);
+
+    // Whether the tile is stored as a single color, which is then copied to color
+    bool IsUniform(unsigned int column, unsigned int row, unsigned char color[4]) const;
+
+    // TILE_SIZE x TILE_SIZE pixels of the tile, top row first, even past the image's edges.
+    // A uniform tile gets its pixels stored from now on. Valid until the next TileCache::Trim.
+    unsigned char* GetTile(unsigned int column, unsigned int row);
+
+    // Stores the tile as a single color again if all its pixels inside the image have the same one
+    void Compact(unsigned int column, unsigned int row);
+
+    // Copies rect from pixels, whose rows are stride bytes apart and start with the top one; stride may be negative
+    void Write(const QRect& rect, const unsigned char* pixels, ptrdiff_t stride);
+
+    // Copies rect to pixels, laid out as for Write
+    void Read(const QRect& rect, unsigned char* pixels, ptrdiff_t stride);
+
+    // Copy of the whole image in one buffer. Trims the TileCache as it goes.
+    std::shared_ptr<RGBABuffer> ToBuffer();
+
+private:
+    // Pixels of uniform tiles aren't stored
+    static const unsigned int NO_PIXELS = ~0u;
+
+    struct Tile {
+        unsigned char color[4];
+        // TileCache id
+        unsigned int pixels;
+    };
+
+    // Frees the tile's pixels and makes it uniform
+    void SetUniform(Tile& tile, const unsigned char color[4]);
+
+    unsigned int width_;
+    unsigned int height_;
+    unsigned int columns_;
+    unsigned int rows_;
+    // Row by row
+    std::vector<Tile> tiles_;
+};
+
+#endif // TILEDIMAGE_H
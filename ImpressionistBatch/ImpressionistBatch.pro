@@ -0,0 +1,108 @@
+# Make sure we're using an up-to-date version of Qt
+lessThan( QT_MAJOR_VERSION, 5 ): error( "Qt version 5.7+ required" )
+lessThan( QT_MINOR_VERSION, 7 ): error( "Qt version 5.7+ required" )
+
+# Brushes keep their parameters in widgets, so the batch renderer needs the widgets module too
+QT = core gui widgets
+
+# Command line application rendering images without a window
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+# Executable name
+TARGET = ImpressionistBatch
+
+# Directory in which the executable will be placed
+OBJECTS_DIR = tmp
+
+# General project configuration options
+CONFIG -= flat
+CONFIG += c++14 force_debug_info
+
+# Sources shared with the Impressionist application
+IMPRESSIONIST_SRC = $$_PRO_FILE_PWD_/../Impressionist/src
+
+# List of filesnames of header files used when building the project
+HEADERS += \
+    $$IMPRESSIONIST_SRC/glinclude.h \
+    $$IMPRESSIONIST_SRC/layer.h \
+    $$IMPRESSIONIST_SRC/strokebatch.h \
+    $$IMPRESSIONIST_SRC/softwarerasterizer.h \
+    $$IMPRESSIONIST_SRC/tilecache.h \
+    $$IMPRESSIONIST_SRC/tiledimage.h \
+    $$IMPRESSIONIST_SRC/imageloader.h \
+    $$IMPRESSIONIST_SRC/referenceimage.h \
+    $$IMPRESSIONIST_SRC/offscreencanvas.h \
+    $$IMPRESSIONIST_SRC/softwarecanvas.h \
+    $$IMPRESSIONIST_SRC/autopainter.h \
+    $$IMPRESSIONIST_SRC/gradientfield.h \
+    $$IMPRESSIONIST_SRC/vectors.h \
+    $$IMPRESSIONIST_SRC/qlabeledslider.h \
+    $$IMPRESSIONIST_SRC/threadpool.h \
+    $$IMPRESSIONIST_SRC/alignedallocator.h \
+    $$IMPRESSIONIST_SRC/rgbabuffer.h \
+    $$IMPRESSIONIST_SRC/filters/filter.h \
+    $$IMPRESSIONIST_SRC/filters/filtersimd.h \
+    $$IMPRESSIONIST_SRC/brushes/brush.h \
+    $$IMPRESSIONIST_SRC/brushes/pointbrush.h \
+    $$IMPRESSIONIST_SRC/brushes/linebrush.h \
+    $$IMPRESSIONIST_SRC/brushes/circlebrush.h \
+    $$IMPRESSIONIST_SRC/brushes/scatterpointbrush.h \
+    $$IMPRESSIONIST_SRC/brushes/scatterlinebrush.h \
+    $$IMPRESSIONIST_SRC/brushes/scattercirclebrush.h \
+    $$IMPRESSIONIST_SRC/brushes/uwbrush.h \
+    $$IMPRESSIONIST_SRC/brushes/star.h
+
+# List of source code files to be used when building the project
+SOURCES += \
+    src/main.cpp \
+    $$IMPRESSIONIST_SRC/layer.cpp \
+    $$IMPRESSIONIST_SRC/strokebatch.cpp \
+    $$IMPRESSIONIST_SRC/softwarerasterizer.cpp \
+    $$IMPRESSIONIST_SRC/tilecache.cpp \
+    $$IMPRESSIONIST_SRC/tiledimage.cpp \
+    $$IMPRESSIONIST_SRC/imageloader.cpp \
+    $$IMPRESSIONIST_SRC/referenceimage.cpp \
+    $$IMPRESSIONIST_SRC/offscreencanvas.cpp \
+    $$IMPRESSIONIST_SRC/softwarecanvas.cpp \
+    $$IMPRESSIONIST_SRC/autopainter.cpp \
+    $$IMPRESSIONIST_SRC/gradientfield.cpp \
+    $$IMPRESSIONIST_SRC/glerror.cpp \
+    $$IMPRESSIONIST_SRC/qlabeledslider.cpp \
+    $$IMPRESSIONIST_SRC/threadpool.cpp \
+    $$IMPRESSIONIST_SRC/filters/filter.cpp \
+    $$IMPRESSIONIST_SRC/filters/filtersimd.cpp \
+    $$IMPRESSIONIST_SRC/brushes/brush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/pointbrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/linebrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/circlebrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/scatterpointbrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/scatterlinebrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/scattercirclebrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/uwbrush.cpp \
+    $$IMPRESSIONIST_SRC/brushes/star.cpp
+
+# Specifies the include directories which should be searched when compiling the project
+INCLUDEPATH += \
+    "$$IMPRESSIONIST_SRC" \
+    "$$_PRO_FILE_PWD_/../Libraries" \
+
+# Depend on OpenGL
+win32:LIBS += -lopengl32
+linux:LIBS += -lGL
+macx:LIBS += -framework OpenGL -framework CoreFoundation
+
+# Depend on GLEW Library
+win32:CONFIG(release, debug|release): LIBS += -L$$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin -lGLEW
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin -lGLEWd
+else:linux: LIBS += -L$$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin -lGLEW
+
+INCLUDEPATH += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/include
+DEPENDPATH += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/include
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin/libGLEW.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/lib/bin/GLEWd.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin/GLEW.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin/GLEWd.lib
+else:linux: PRE_TARGETDEPS += $$_PRO_FILE_PWD_/../Libraries/glew-2.0.0/bin/libglew-2.a
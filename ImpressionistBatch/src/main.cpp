@@ -0,0 +1,233 @@
+#include <glinclude.h>
+#include <offscreencanvas.h>
+#include <softwarecanvas.h>
+#include <autopainter.h>
+#include <imageloader.h>
+#include <referenceimage.h>
+#include <filters/filter.h>
+#include <brushes/brush.h>
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+// A reference image decoded, and blurred if asked, on a worker thread
+struct Reference {
+    QString error;
+    std::shared_ptr<const ReferenceImage> image;
+};
+
+// One image to paint
+struct Job {
+    QString input;
+    QString output;
+};
+
+// Brush types by the name given to --brush
+static const std::map<QString, Brushes> BRUSH_NAMES = {
+    { "points", Brushes::Point },
+    { "lines", Brushes::Line },
+    { "circles", Brushes::Circle },
+    { "scattered-points", Brushes::ScatterPoint },
+    { "scattered-lines", Brushes::ScatterLine },
+    { "scattered-circles", Brushes::ScatterCircle },
+    { "uw", Brushes::UW },
+    { "star", Brushes::Star }
+};
+
+static Reference LoadReference(const QString& filename, float blur) {
+    Reference reference;
+    std::shared_ptr<RGBABuffer> image = ImageLoader::Load(filename);
+    if (!image) {
+        reference.error = "Failed to import image \"" + filename + "\"";
+        return reference;
+    }
+
+    unsigned int width = image->Width;
+    unsigned int height = image->Height;
+    if (blur > 0.0f) {
+        // Softens the colors the brushes sample, like filtering the reference in the application first
+        std::shared_ptr<RGBABuffer> blurred = std::make_shared<RGBABuffer>(width, height);
+        Filter::ApplyGaussianBlur(image->Bytes, blurred->Bytes, width, height, blur, blur >= 5.0f ? BlurMode::Box : BlurMode::Exact);
+        image = blurred;
+    }
+    reference.image = std::make_shared<const ReferenceImage>(image);
+    return reference;
+}
+
+static QString SaveCanvas(std::shared_ptr<const RGBABuffer> canvas, const QString& filename) {
+    // Snapshots come bottom row first, like PaintView's
+    QImage image(canvas->Bytes, canvas->Width, canvas->Height, QImage::Format_RGBA8888);
+    if (!image.mirrored().save(filename)) return "Failed to save image \"" + filename + "\"";
+    return QString();
+}
+
+// Lists the images to paint, or returns false after printing why there are none
+static bool ListJobs(const QString& input, const QString& output, std::vector<Job>& jobs) {
+    QFileInfo input_info(input);
+    if (!input_info.exists()) {
+        std::cerr << "No such file or directory \"" << input.toStdString() << "\"" << std::endl;
+        return false;
+    }
+
+    if (input_info.isFile()) {
+        // A single image may still be written into a directory
+        QFileInfo output_info(output);
+        jobs.push_back({ input, output_info.isDir() ? QDir(output).filePath(input_info.fileName()) : output });
+        return true;
+    }
+
+    if (!QDir().mkpath(output)) {
+        std::cerr << "Failed to create directory \"" << output.toStdString() << "\"" << std::endl;
+        return false;
+    }
+    QDir input_dir(input);
+    QDir output_dir(output);
+    for (const QFileInfo& file : input_dir.entryInfoList({ "*.jpg", "*.jpeg", "*.png", "*.bmp" }, QDir::Files, QDir::Name)) {
+        jobs.push_back({ file.filePath(), output_dir.filePath(file.fileName()) });
+    }
+    return true;
+}
+
+// Sets the brush sliders from Name=value pairs, or returns false after printing the first one that doesn't apply
+static bool SetParameters(Brush& brush, const QStringList& parameters) {
+    for (const QString& parameter : parameters) {
+        int separator = parameter.indexOf('=');
+        bool valid = false;
+        int value = separator > 0 ? parameter.mid(separator + 1).toInt(&valid) : 0;
+        if (!valid || !brush.SetParameter(parameter.left(separator).toStdString(), value)) {
+            std::cerr << "Invalid brush parameter \"" << parameter.toStdString() << "\" for " << brush.GetName() << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Paints every job on canvas, an OffscreenCanvas or SoftwareCanvas, and returns how many failed
+template <class Canvas>
+static int PaintJobs(Canvas& canvas, const std::vector<Job>& jobs, Brush& brush, const AutoPainter::Settings& settings,
+                     float blur, unsigned int job_count) {
+    // Decoding, blurring and encoding run on worker threads around the painting, which may need the GL context of this thread.
+    // Up to job_count images are decoded ahead and job_count written behind.
+    std::deque<std::future<Reference>> loads;
+    std::deque<std::future<QString>> saves;
+    unsigned int next_load = 0;
+    int failures = 0;
+    auto finish_save = [&saves, &failures]() {
+        QString error = saves.front().get();
+        saves.pop_front();
+        if (!error.isEmpty()) {
+            std::cerr << error.toStdString() << std::endl;
+            failures++;
+        }
+    };
+
+    for (const Job& job : jobs) {
+        while (next_load < jobs.size() && loads.size() < job_count) {
+            QString input = jobs[next_load++].input;
+            loads.push_back(std::async(std::launch::async, LoadReference, input, blur));
+        }
+        Reference reference = loads.front().get();
+        loads.pop_front();
+        if (!reference.image) {
+            std::cerr << reference.error.toStdString() << std::endl;
+            failures++;
+            continue;
+        }
+
+        unsigned int width = reference.image->GetWidth();
+        unsigned int height = reference.image->GetHeight();
+        canvas.Resize(width, height);
+        canvas.Clear(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+        // The scattering brushes jitter their dabs with rand
+        srand(settings.seed);
+        AutoPainter::Paint(reference.image, brush, settings,
+                           [&canvas](Brush& brush, const std::vector<AutoPainter::Dab>& dabs) { canvas.DrawDabs(brush, dabs); },
+                           [&canvas]() { return canvas.GetSnapshot(); });
+        std::shared_ptr<const RGBABuffer> painted = canvas.GetSnapshot();
+        brush.SetColorImage(nullptr);
+
+        if (saves.size() >= job_count) finish_save();
+        saves.push_back(std::async(std::launch::async, SaveCanvas, painted, job.output));
+        std::cout << job.input.toStdString() << " -> " << job.output.toStdString() << std::endl;
+    }
+    while (!saves.empty()) finish_save();
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+    // Same context as the application's, so brushes render identically
+    QSurfaceFormat glFormat;
+    glFormat.setRenderableType( QSurfaceFormat::OpenGL );
+    glFormat.setMajorVersion( 4 );
+    glFormat.setMinorVersion( 1 );
+    glFormat.setProfile( QSurfaceFormat::CoreProfile );
+    QSurfaceFormat::setDefaultFormat(glFormat);
+
+    // Brushes keep their parameters in widgets, which need a QApplication even though none is shown
+    QApplication a(argc, argv);
+    QApplication::setApplicationName("ImpressionistBatch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Paints images with an Impressionist brush without opening a window.\n"
+                                     "On a machine without a display, pass -platform offscreen.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Image, or directory of images, to paint.");
+    parser.addPositionalArgument("output", "Painted image, or directory to write the painted images to.");
+    QCommandLineOption brush_option("brush", "Brush to paint with: points, lines, circles, scattered-points, scattered-lines, scattered-circles, uw or star.", "name", "circles");
+    QCommandLineOption set_option("set", "Sets a brush slider, like Size=20 or Spacing=50. May be repeated.", "name=value");
+    QCommandLineOption blur_option("blur", "Blurs the reference by a gaussian of sigma before sampling colors from it.", "sigma", "0");
+    QCommandLineOption jobs_option("jobs", "Images decoded and encoded at once. Defaults to the number of cores.", "count", "0");
+    QCommandLineOption layers_option("layers", "Brush sizes painted from coarse to fine, each twice the next, ending with the brush's Size.", "count", "3");
+    QCommandLineOption threshold_option("threshold", "Mean color difference, out of 255, below which finer layers leave the canvas as it is.", "difference", "20");
+    QCommandLineOption cpu_option("cpu", "Draws the brushes on the CPU, which needs no OpenGL. Edges differ slightly from the GPU's.");
+    QCommandLineOption seed_option("seed", "Seed placing the dabs, the same seed paints the same image.", "seed", "0");
+    parser.addOptions({ brush_option, set_option, blur_option, layers_option, threshold_option, jobs_option, seed_option, cpu_option });
+    parser.process(a);
+
+    QStringList positional = parser.positionalArguments();
+    if (positional.size() != 2) parser.showHelp(1);
+
+    if (BRUSH_NAMES.count(parser.value(brush_option)) == 0) {
+        std::cerr << "Unknown brush \"" << parser.value(brush_option).toStdString() << "\"" << std::endl;
+        return 1;
+    }
+    std::unique_ptr<Brush> brush = Brush::Create(BRUSH_NAMES.at(parser.value(brush_option)));
+    if (!SetParameters(*brush, parser.values(set_option))) return 1;
+    brush->SetColorMode(ColorMode::Sample);
+
+    float blur = parser.value(blur_option).toFloat();
+    AutoPainter::Settings settings;
+    settings.layers = parser.value(layers_option).toUInt();
+    settings.threshold = parser.value(threshold_option).toFloat();
+    settings.seed = parser.value(seed_option).toUInt();
+    unsigned int job_count = parser.value(jobs_option).toUInt();
+    if (job_count == 0) job_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<Job> jobs;
+    if (!ListJobs(positional[0], positional[1], jobs)) return 1;
+
+    int failures;
+    if (parser.isSet(cpu_option)) {
+        SoftwareCanvas canvas;
+        failures = PaintJobs(canvas, jobs, *brush, settings, blur, job_count);
+    } else {
+        OffscreenCanvas canvas;
+        if (!canvas.IsValid()) {
+            std::cerr << "Failed to create an OpenGL 4.1 context, pass --cpu to paint without one" << std::endl;
+            return 1;
+        }
+        failures = PaintJobs(canvas, jobs, *brush, settings, blur, job_count);
+    }
+
+    return failures == 0 ? 0 : 1;
+}